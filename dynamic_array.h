@@ -1,48 +1,410 @@
 #pragma once
 
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Where an array's memory comes from. Arrays with a NULL allocator use
+// malloc, realloc and free.
+typedef struct dyn_arr_allocator {
+  // Resizes ptr (NULL for a new block) from old_size to new_size bytes,
+  // keeping the contents, like realloc.
+  void *(*resize)(struct dyn_arr_allocator *self, void *ptr, size_t old_size, size_t new_size);
+  // NULL if blocks are only given back all at once, as with an arena.
+  void (*release)(struct dyn_arr_allocator *self, void *ptr, size_t size);
+} dyn_arr_allocator;
+
 #define DYN_ARR_OF(type) struct  { \
   type *data; \
   type *endptr; \
   uint32_t capacity; \
+  uint32_t flags; \
+  dyn_arr_allocator *allocator; \
+}
+
+// data points at storage that isn't from malloc, and mustn't be freed.
+#define DYN_ARR_FLAG_INLINE 1u
+// data points into a file mapped by DYN_ARR_MAP, and is unmapped instead.
+#define DYN_ARR_FLAG_MAPPED 4u
+// Either way, growing copies the elements out to the allocator's memory.
+#define DYN_ARR_FLAG_BORROWED (DYN_ARR_FLAG_INLINE | DYN_ARR_FLAG_MAPPED)
+
+// Like DYN_ARR_OF, with room for n elements inside the struct, so small arrays
+// never allocate. Set up with DYN_ARR_SMALL_RESET; all the other macros work
+// the same, and move the elements to the heap when they outgrow the struct.
+// data points into the struct, so don't copy one while it's inline.
+#define DYN_ARR_SMALL_OF(type, n) struct  { \
+  type *data; \
+  type *endptr; \
+  uint32_t capacity; \
+  uint32_t flags; \
+  dyn_arr_allocator *allocator; \
+  type inline_data[n]; \
 }
 
 #if !defined(__cplusplus)
 #define decltype(x) void*
 #endif
 
-#define DYN_ARR_RESET(a, c) { \
-  a.data = (decltype(a.data))malloc(sizeof(a.data[0]) * c); \
+// How capacity grows when an append doesn't fit. Define DYN_ARR_GROWTH to one
+// of these before including this header, or to your own function taking
+// (capacity, needed, element size) and returning a capacity >= needed.
+#if !defined(DYN_ARR_GROWTH)
+#define DYN_ARR_GROWTH dyn_arr_grow_double
+#endif
+
+#if !defined(DYN_ARR_MIN_CAPACITY)
+#define DYN_ARR_MIN_CAPACITY 8u
+#endif
+
+#if !defined(DYN_ARR_PAGE_SIZE)
+#define DYN_ARR_PAGE_SIZE 4096u
+#endif
+
+static inline uint32_t dyn_arr__clamp_capacity(uint64_t capacity, size_t needed) {
+  assert(needed <= UINT32_MAX);
+  if (capacity < needed) capacity = needed;
+  if (capacity < DYN_ARR_MIN_CAPACITY) capacity = DYN_ARR_MIN_CAPACITY;
+  return capacity > UINT32_MAX ? UINT32_MAX : (uint32_t)capacity;
+}
+
+static inline uint32_t dyn_arr_grow_double(uint32_t capacity, size_t needed, size_t elem_size) {
+  (void)elem_size;
+  return dyn_arr__clamp_capacity((uint64_t)capacity * 2u, needed);
+}
+
+// Wastes less memory than doubling, at the cost of more reallocs.
+static inline uint32_t dyn_arr_grow_1_5x(uint32_t capacity, size_t needed, size_t elem_size) {
+  (void)elem_size;
+  return dyn_arr__clamp_capacity((uint64_t)capacity + capacity / 2u, needed);
+}
+
+// Doubles, then uses the rest of the last page: large allocations come
+// straight from the OS in whole pages anyway.
+static inline uint32_t dyn_arr_grow_pages(uint32_t capacity, size_t needed, size_t elem_size) {
+  uint64_t bytes = (uint64_t)dyn_arr__clamp_capacity((uint64_t)capacity * 2u, needed) * elem_size;
+  bytes = (bytes + DYN_ARR_PAGE_SIZE - 1u) / DYN_ARR_PAGE_SIZE * DYN_ARR_PAGE_SIZE;
+  return dyn_arr__clamp_capacity(bytes / elem_size, needed);
+}
+
+static inline void *dyn_arr__resize(dyn_arr_allocator *allocator, void *ptr, size_t old_size, size_t new_size) {
+  if (allocator == NULL) return realloc(ptr, new_size);
+  return allocator->resize(allocator, ptr, old_size, new_size);
+}
+
+static inline void dyn_arr__release(dyn_arr_allocator *allocator, void *ptr, size_t size) {
+  if (allocator == NULL) {
+    free(ptr);
+  } else if (allocator->release != NULL) {
+    allocator->release(allocator, ptr, size);
+  }
+}
+
+// Build with DYN_ARR_INSTRUMENT defined to 1 to find out which arrays are
+// reallocated the most: RESET, growth (from any macro) and DESTROY are
+// counted per call site, in a table per thread, and
+// DYN_ARR_INSTRUMENT_REPORT(file) prints the totals across all threads.
+// Otherwise all of this compiles to nothing.
+#if !defined(DYN_ARR_INSTRUMENT)
+#define DYN_ARR_INSTRUMENT 0
+#endif
+
+#if DYN_ARR_INSTRUMENT
+#if !defined(DYN_ARR_INSTRUMENT_SITES)
+#define DYN_ARR_INSTRUMENT_SITES 1024u // per thread, a power of two
+#endif
+
+typedef struct dyn_arr_site_stats {
+  const char *file;
+  uint32_t line; // 0 while the entry is unused
+  uint32_t elem_size;
+  uint64_t resets, reallocs, destroys;
+  uint64_t bytes_copied; // by growth that couldn't extend in place
+  uint64_t peak_capacity;
+  uint64_t slack; // capacity - size at DESTROY, in bytes, summed
+} dyn_arr_site_stats;
+
+typedef struct dyn_arr__thread_stats {
+  dyn_arr_site_stats sites[DYN_ARR_INSTRUMENT_SITES];
+  struct dyn_arr__thread_stats *next;
+} dyn_arr__thread_stats;
+
+// Weak, so every translation unit shares them.
+__attribute__((weak)) dyn_arr__thread_stats *dyn_arr__all_stats;
+__attribute__((weak)) __thread dyn_arr__thread_stats *dyn_arr__my_stats;
+
+// Only the owning thread writes its table, so these need no locked
+// instructions; they're atomic so the report can read them while it runs.
+#define DYN_ARR__STAT_ADD(field, n) \
+  __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+static inline dyn_arr_site_stats *dyn_arr__site(const char *file, uint32_t line, size_t elem_size) {
+  dyn_arr__thread_stats *stats = dyn_arr__my_stats;
+  if (stats == NULL) {
+    // Never freed, not even when the thread exits: the report still counts
+    // threads that have finished, and this header stays free of pthreads.
+    // That's one table (about 64 KB) per thread that ever touched an array.
+    stats = (dyn_arr__thread_stats *)calloc(1, sizeof(dyn_arr__thread_stats));
+    if (stats == NULL) return NULL;
+    stats->next = __atomic_load_n(&dyn_arr__all_stats, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&dyn_arr__all_stats, &stats->next, stats, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    dyn_arr__my_stats = stats;
+  }
+  size_t mask = DYN_ARR_INSTRUMENT_SITES - 1u;
+  size_t i = (((uintptr_t)file >> 4) ^ (line * 0x9e3779b1u)) & mask;
+  for (size_t probes = 0; probes <= mask; ++probes, i = (i + 1u) & mask) {
+    dyn_arr_site_stats *site = &stats->sites[i];
+    if (site->line == line && site->file == file) return site;
+    if (site->line == 0) {
+      site->file = file;
+      site->elem_size = (uint32_t)elem_size;
+      __atomic_store_n(&site->line, line, __ATOMIC_RELEASE);
+      return site;
+    }
+  }
+  return NULL; // full: not counted
+}
+
+static inline void dyn_arr__record(const char *file, uint32_t line, size_t elem_size, int event,
+                                   uint64_t capacity, uint64_t copied, uint64_t slack) {
+  dyn_arr_site_stats *site = dyn_arr__site(file, line, elem_size);
+  if (site == NULL) return;
+  switch (event) {
+    case 0: DYN_ARR__STAT_ADD(site->resets, 1u); break;
+    case 1: DYN_ARR__STAT_ADD(site->reallocs, 1u); break;
+    case 2: DYN_ARR__STAT_ADD(site->destroys, 1u); break;
+  }
+  DYN_ARR__STAT_ADD(site->bytes_copied, copied);
+  DYN_ARR__STAT_ADD(site->slack, slack);
+  if (capacity > __atomic_load_n(&site->peak_capacity, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&site->peak_capacity, capacity, __ATOMIC_RELAXED);
+  }
+}
+
+static inline int dyn_arr__compare_sites(const void *a, const void *b) {
+  const dyn_arr_site_stats *x = (const dyn_arr_site_stats *)a, *y = (const dyn_arr_site_stats *)b;
+  if (x->bytes_copied != y->bytes_copied) return x->bytes_copied > y->bytes_copied ? -1 : 1;
+  if (x->reallocs != y->reallocs) return x->reallocs > y->reallocs ? -1 : 1;
+  return 0;
+}
+
+// Prints each call site's totals over all threads, most bytes copied first.
+static inline void dyn_arr_instrument_report(FILE *out) {
+  size_t count = 0, capacity = 64;
+  dyn_arr_site_stats *sites = (dyn_arr_site_stats *)malloc(sizeof(dyn_arr_site_stats) * capacity);
+  if (sites == NULL) return;
+  for (dyn_arr__thread_stats *stats = __atomic_load_n(&dyn_arr__all_stats, __ATOMIC_ACQUIRE);
+       stats != NULL; stats = stats->next) {
+    for (size_t i = 0; i < DYN_ARR_INSTRUMENT_SITES; ++i) {
+      const dyn_arr_site_stats *site = &stats->sites[i];
+      uint32_t line = __atomic_load_n(&site->line, __ATOMIC_ACQUIRE);
+      if (line == 0) continue;
+      // The same site appears once per thread, and under another file
+      // pointer for each translation unit that includes it.
+      size_t j = 0;
+      while (j < count && !(sites[j].line == line && strcmp(sites[j].file, site->file) == 0)) ++j;
+      if (j == count) {
+        if (count == capacity) {
+          dyn_arr_site_stats *more = (dyn_arr_site_stats *)realloc(sites, sizeof(dyn_arr_site_stats) * capacity * 2u);
+          if (more == NULL) break;
+          sites = more;
+          capacity *= 2u;
+        }
+        memset(&sites[count], 0, sizeof(sites[count]));
+        sites[count].file = site->file;
+        sites[count].line = line;
+        sites[count].elem_size = site->elem_size;
+        ++count;
+      }
+      sites[j].resets += __atomic_load_n(&site->resets, __ATOMIC_RELAXED);
+      sites[j].reallocs += __atomic_load_n(&site->reallocs, __ATOMIC_RELAXED);
+      sites[j].destroys += __atomic_load_n(&site->destroys, __ATOMIC_RELAXED);
+      sites[j].bytes_copied += __atomic_load_n(&site->bytes_copied, __ATOMIC_RELAXED);
+      sites[j].slack += __atomic_load_n(&site->slack, __ATOMIC_RELAXED);
+      uint64_t peak = __atomic_load_n(&site->peak_capacity, __ATOMIC_RELAXED);
+      if (peak > sites[j].peak_capacity) sites[j].peak_capacity = peak;
+    }
+  }
+  qsort(sites, count, sizeof(sites[0]), dyn_arr__compare_sites);
+  fprintf(out, "%-40s %8s %8s %8s %14s %12s %14s\n",
+          "site", "resets", "reallocs", "destroys", "bytes copied", "peak cap", "slack bytes");
+  for (size_t i = 0; i < count; ++i) {
+    char where[41];
+    snprintf(where, sizeof(where), "%s:%u", sites[i].file, (unsigned)sites[i].line);
+    fprintf(out, "%-40s %8llu %8llu %8llu %14llu %12llu %14llu\n", where,
+            (unsigned long long)sites[i].resets, (unsigned long long)sites[i].reallocs,
+            (unsigned long long)sites[i].destroys, (unsigned long long)sites[i].bytes_copied,
+            (unsigned long long)sites[i].peak_capacity, (unsigned long long)sites[i].slack);
+  }
+  free(sites);
+}
+
+#define DYN_ARR__ON_RESET(a) \
+  dyn_arr__record(__FILE__, __LINE__, sizeof(a.data[0]), 0, a.capacity, 0, 0)
+// Growth only copies if the block moved.
+#define DYN_ARR__ON_REALLOC(a, old_data, size) \
+  dyn_arr__record(__FILE__, __LINE__, sizeof(a.data[0]), 1, a.capacity, \
+                  (void *)(old_data) != (void *)a.data ? sizeof(a.data[0]) * (size) : 0, 0)
+#define DYN_ARR__ON_DESTROY(a) \
+  dyn_arr__record(__FILE__, __LINE__, sizeof(a.data[0]), 2, a.capacity, 0, \
+                  sizeof(a.data[0]) * (a.capacity - DYN_ARR_SIZE(a)))
+#define DYN_ARR_INSTRUMENT_REPORT(file) dyn_arr_instrument_report(file)
+#else
+#define DYN_ARR__ON_RESET(a) ((void)0)
+#define DYN_ARR__ON_REALLOC(a, old_data, size) ((void)0)
+#define DYN_ARR__ON_DESTROY(a) ((void)0)
+#define DYN_ARR_INSTRUMENT_REPORT(file) ((void)0)
+#endif
+
+// Saved arrays start this far into the file, after the header.
+#define DYN_ARR_FILE_HEADER_SIZE 64u
+
+// Lets go of borrowed data of bytes bytes: nothing to do for inline data.
+static inline void dyn_arr__drop_borrowed(uint32_t flags, void *data, size_t bytes) {
+#if defined(__unix__) || defined(__APPLE__)
+  if (flags & DYN_ARR_FLAG_MAPPED) {
+    munmap((char *)data - DYN_ARR_FILE_HEADER_SIZE, DYN_ARR_FILE_HEADER_SIZE + bytes);
+  }
+#else
+  (void)flags, (void)data, (void)bytes;
+#endif
+}
+
+// Reallocs a to exactly c elements, keeping its size (which must fit).
+// Borrowed elements are copied out to the heap instead.
+#define DYN_ARR__REALLOC(a, c) { \
+  ptrdiff_t dyn_arr_size = a.endptr - a.data; \
+  uint32_t dyn_arr_capacity = (c); \
+  assert(dyn_arr_size >= 0 && (size_t)dyn_arr_size <= dyn_arr_capacity); \
+  decltype(a.data) dyn_arr_tmp; \
+  decltype(a.data) dyn_arr_old = a.data; \
+  (void)dyn_arr_old; \
+  if (a.flags & DYN_ARR_FLAG_BORROWED) { \
+    dyn_arr_tmp = (decltype(a.data))dyn_arr__resize(a.allocator, NULL, 0, sizeof(a.data[0]) * dyn_arr_capacity); \
+    assert(dyn_arr_tmp != NULL); \
+    memcpy(dyn_arr_tmp, a.data, sizeof(a.data[0]) * dyn_arr_size); \
+    dyn_arr__drop_borrowed(a.flags, a.data, sizeof(a.data[0]) * a.capacity); \
+    a.flags &= ~DYN_ARR_FLAG_BORROWED; \
+  } else { \
+    dyn_arr_tmp = (decltype(a.data))dyn_arr__resize(a.allocator, a.data, \
+      sizeof(a.data[0]) * a.capacity, sizeof(a.data[0]) * dyn_arr_capacity); \
+    assert(dyn_arr_tmp != NULL || dyn_arr_capacity == 0); \
+  } \
+  a.data = dyn_arr_tmp; \
+  a.endptr = a.data + dyn_arr_size; \
+  a.capacity = dyn_arr_capacity; \
+  DYN_ARR__ON_REALLOC(a, dyn_arr_old, dyn_arr_size); \
+}
+
+// Makes room for at least n elements in total, growing by DYN_ARR_GROWTH.
+#define DYN_ARR__GROW(a, n) { \
+  size_t dyn_arr_needed = (n); \
+  if (dyn_arr_needed > a.capacity) { \
+    DYN_ARR__REALLOC(a, DYN_ARR_GROWTH(a.capacity, dyn_arr_needed, sizeof(a.data[0]))); \
+  } \
+}
+
+#define DYN_ARR_RESET(a, c) DYN_ARR_RESET_WITH(a, c, NULL)
+
+// Like DYN_ARR_RESET, with memory from allocator from now on.
+#define DYN_ARR_RESET_WITH(a, c, alloc) { \
+  a.allocator = (alloc); \
+  a.data = (decltype(a.data))dyn_arr__resize(a.allocator, NULL, 0, sizeof(a.data[0]) * (c)); \
   a.endptr = a.data; \
-  a.capacity = c; \
+  a.capacity = (c); \
+  a.flags = 0; \
+  DYN_ARR__ON_RESET(a); \
+}
+
+// Starts a DYN_ARR_SMALL_OF array empty, in its inline storage.
+#define DYN_ARR_SMALL_RESET(a) { \
+  a.data = a.inline_data; \
+  a.endptr = a.data; \
+  a.capacity = sizeof(a.inline_data) / sizeof(a.inline_data[0]); \
+  a.flags = DYN_ARR_FLAG_INLINE; \
+  a.allocator = NULL; \
 }
 
 #define DYN_ARR_RESIZE(a, s) { \
   uint32_t size = (s); \
   if (a.capacity < size) { \
-    a.data = (decltype(a.data))realloc(a.data, sizeof(a.data[0]) * size); \
-    a.capacity = size; \
+    DYN_ARR__REALLOC(a, size); \
   } \
   a.endptr = a.data + size; \
 } 
 
 #define DYN_ARR_DESTROY(a) if(a.data != NULL) { \
-  free(a.data); \
+  DYN_ARR__ON_DESTROY(a); \
+  if (a.flags & DYN_ARR_FLAG_BORROWED) { \
+    dyn_arr__drop_borrowed(a.flags, a.data, sizeof(a.data[0]) * a.capacity); \
+  } else { \
+    dyn_arr__release(a.allocator, a.data, sizeof(a.data[0]) * a.capacity); \
+  } \
   a.data = a.endptr = NULL; \
+  a.capacity = 0; \
+  a.flags = 0; \
 }
 
 #define DYN_ARR_APPEND(a, v) { \
-  ptrdiff_t cur_size = a.endptr - a.data; \
-  assert(cur_size >= 0);                                 \
-  if ((size_t)cur_size >= a.capacity) { \
-    a.capacity <<= 1u; \
-    decltype(a.data) tmp = (decltype(a.data)) realloc(a.data, sizeof(a.data[0]) * a.capacity); \
-    assert(tmp != NULL); \
-    a.data = tmp; \
-    a.endptr = &a.data[cur_size]; \
+  if (a.endptr == a.data + a.capacity) { \
+    DYN_ARR__GROW(a, (size_t)a.capacity + 1u); \
   } \
   *(a.endptr++) = v; \
 }
 
+// Makes room for n elements in total, without changing the size. Unlike
+// appends, this allocates exactly n.
+#define DYN_ARR_RESERVE(a, n) { \
+  size_t dyn_arr_reserve = (n); \
+  if (dyn_arr_reserve > a.capacity) { \
+    DYN_ARR__REALLOC(a, dyn_arr_reserve); \
+  } \
+}
+
+// Appends n elements copied from src, growing at most once.
+#define DYN_ARR_APPEND_N(a, src, n) { \
+  size_t dyn_arr_count = (n); \
+  DYN_ARR__GROW(a, DYN_ARR_SIZE(a) + dyn_arr_count); \
+  memcpy(a.endptr, (src), sizeof(a.data[0]) * dyn_arr_count); \
+  a.endptr += dyn_arr_count; \
+}
+
+// Grows a by n elements, left uninitialized, and points ptr at the first
+// of them so they can be written in place.
+#define DYN_ARR_EXTEND_UNINIT(a, n, ptr) { \
+  size_t dyn_arr_count = (n); \
+  DYN_ARR__GROW(a, DYN_ARR_SIZE(a) + dyn_arr_count); \
+  (ptr) = a.endptr; \
+  a.endptr += dyn_arr_count; \
+}
+
+// Gives back unused capacity. An empty array is freed.
+#define DYN_ARR_SHRINK_TO_FIT(a) { \
+  uint32_t dyn_arr_fit = DYN_ARR_SIZE(a); \
+  if (a.flags & DYN_ARR_FLAG_BORROWED) { \
+    /* nothing to give back */ \
+  } else if (dyn_arr_fit == 0) { \
+    dyn_arr__release(a.allocator, a.data, sizeof(a.data[0]) * a.capacity); \
+    a.data = a.endptr = NULL; \
+    a.capacity = 0; \
+  } else if (dyn_arr_fit < a.capacity) { \
+    DYN_ARR__REALLOC(a, dyn_arr_fit); \
+  } \
+}
+
 #define DYN_ARR_CLEAR(a) (a.endptr = a.data)
 #define DYN_ARR_SIZE(a) ((uint32_t)(a.endptr - a.data))
 #define DYN_ARR_AT(a, i) (a.data[i])
@@ -59,6 +421,1022 @@
 #define DYN_ARR_FOREACH(a, countername) \
 for (size_t countername = 0; (countername) < DYN_ARR_SIZE(a); ++(countername))
 
+// Alignment of everything from the arena and the pool.
+#define DYN_ARR_ALIGN 16u
+#define DYN_ARR__ALIGN_UP(n) (((n) + (DYN_ARR_ALIGN - 1u)) & ~(size_t)(DYN_ARR_ALIGN - 1u))
+
+// A bump allocator for arrays that all die together: releasing is a no-op,
+// and dyn_arr_arena_reset() frees everything at once. The most recent
+// allocation grows in place while the current block has room, so an array
+// that's appended to on its own never copies.
+typedef struct dyn_arr_arena_block {
+  struct dyn_arr_arena_block *next;
+  size_t size;
+} dyn_arr_arena_block;
+
+typedef struct dyn_arr_arena {
+  dyn_arr_allocator allocator; // point arrays at this
+  dyn_arr_arena_block *blocks;
+  char *cur, *end;
+  char *last;
+  size_t block_size;
+} dyn_arr_arena;
+
+static inline void *dyn_arr__arena_alloc(dyn_arr_arena *arena, size_t size) {
+  size = DYN_ARR__ALIGN_UP(size);
+  if ((size_t)(arena->end - arena->cur) < size) {
+    size_t header = DYN_ARR__ALIGN_UP(sizeof(dyn_arr_arena_block));
+    size_t block_size = arena->block_size;
+    if (block_size < header + size) block_size = header + size;
+    dyn_arr_arena_block *block = (dyn_arr_arena_block *)malloc(block_size);
+    if (block == NULL) return NULL;
+    block->next = arena->blocks;
+    block->size = block_size;
+    arena->blocks = block;
+    arena->cur = (char *)block + header;
+    arena->end = (char *)block + block_size;
+  }
+  arena->last = arena->cur;
+  arena->cur += size;
+  return arena->last;
+}
+
+static inline void *dyn_arr__arena_resize(dyn_arr_allocator *self, void *ptr, size_t old_size, size_t new_size) {
+  dyn_arr_arena *arena = (dyn_arr_arena *)self;
+  if (ptr != NULL && ptr == arena->last
+      && DYN_ARR__ALIGN_UP(new_size) <= (size_t)(arena->end - arena->last)) {
+    arena->cur = arena->last + DYN_ARR__ALIGN_UP(new_size);
+    return ptr;
+  }
+  if (new_size <= old_size) return ptr;
+  void *fresh = dyn_arr__arena_alloc(arena, new_size);
+  if (fresh != NULL && ptr != NULL) memcpy(fresh, ptr, old_size);
+  return fresh;
+}
+
+static inline void dyn_arr_arena_init(dyn_arr_arena *arena, size_t block_size) {
+  arena->allocator.resize = dyn_arr__arena_resize;
+  arena->allocator.release = NULL;
+  arena->blocks = NULL;
+  arena->cur = arena->end = arena->last = NULL;
+  arena->block_size = block_size;
+}
+
+// Frees everything allocated from the arena, except its newest block, which
+// is kept for reuse.
+static inline void dyn_arr_arena_reset(dyn_arr_arena *arena) {
+  dyn_arr_arena_block *block = arena->blocks;
+  if (block == NULL) return;
+  while (block->next != NULL) {
+    dyn_arr_arena_block *next = block->next;
+    block->next = next->next;
+    free(next);
+  }
+  arena->cur = (char *)block + DYN_ARR__ALIGN_UP(sizeof(dyn_arr_arena_block));
+  arena->end = (char *)block + block->size;
+  arena->last = NULL;
+}
+
+static inline void dyn_arr_arena_destroy(dyn_arr_arena *arena) {
+  while (arena->blocks != NULL) {
+    dyn_arr_arena_block *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+  dyn_arr_arena_init(arena, arena->block_size);
+}
+
+// Free lists for power-of-two size classes from 16 bytes up to
+// 16 << (DYN_ARR_POOL_CLASSES - 1), carved out of big chunks. Anything
+// larger goes to malloc. Good for many arrays that come and go at different
+// times; all chunks are freed by dyn_arr_pool_destroy().
+#if !defined(DYN_ARR_POOL_CLASSES)
+#define DYN_ARR_POOL_CLASSES 12u
+#endif
+
+#if !defined(DYN_ARR_POOL_CHUNK_SIZE)
+#define DYN_ARR_POOL_CHUNK_SIZE (256u * 1024u)
+#endif
+
+typedef struct dyn_arr_pool {
+  dyn_arr_allocator allocator; // point arrays at this
+  void *free_lists[DYN_ARR_POOL_CLASSES];
+  dyn_arr_arena chunks;
+} dyn_arr_pool;
+
+static inline unsigned dyn_arr__pool_class(size_t size) {
+  unsigned size_class = 0;
+  while (size_class < DYN_ARR_POOL_CLASSES && ((size_t)16u << size_class) < size) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+static inline void dyn_arr__pool_release(dyn_arr_allocator *self, void *ptr, size_t size) {
+  dyn_arr_pool *pool = (dyn_arr_pool *)self;
+  if (ptr == NULL) return;
+  unsigned size_class = dyn_arr__pool_class(size);
+  if (size_class == DYN_ARR_POOL_CLASSES) {
+    free(ptr);
+    return;
+  }
+  *(void **)ptr = pool->free_lists[size_class];
+  pool->free_lists[size_class] = ptr;
+}
+
+static inline void *dyn_arr__pool_resize(dyn_arr_allocator *self, void *ptr, size_t old_size, size_t new_size) {
+  dyn_arr_pool *pool = (dyn_arr_pool *)self;
+  unsigned old_class = dyn_arr__pool_class(old_size);
+  unsigned new_class = dyn_arr__pool_class(new_size);
+  if (ptr != NULL && old_class == new_class) {
+    if (new_class < DYN_ARR_POOL_CLASSES) return ptr;
+    return realloc(ptr, new_size);
+  }
+  void *fresh;
+  if (new_class == DYN_ARR_POOL_CLASSES) {
+    fresh = malloc(new_size);
+  } else if (pool->free_lists[new_class] != NULL) {
+    fresh = pool->free_lists[new_class];
+    pool->free_lists[new_class] = *(void **)fresh;
+  } else {
+    fresh = dyn_arr__arena_alloc(&pool->chunks, (size_t)16u << new_class);
+  }
+  if (fresh != NULL && ptr != NULL) {
+    memcpy(fresh, ptr, old_size < new_size ? old_size : new_size);
+    dyn_arr__pool_release(self, ptr, old_size);
+  }
+  return fresh;
+}
+
+static inline void dyn_arr_pool_init(dyn_arr_pool *pool) {
+  pool->allocator.resize = dyn_arr__pool_resize;
+  pool->allocator.release = dyn_arr__pool_release;
+  for (unsigned i = 0; i < DYN_ARR_POOL_CLASSES; ++i) pool->free_lists[i] = NULL;
+  dyn_arr_arena_init(&pool->chunks, DYN_ARR_POOL_CHUNK_SIZE);
+}
+
+// Arrays still using the pool must not be used after this, except for
+// blocks bigger than the largest class, which need DYN_ARR_DESTROY first.
+static inline void dyn_arr_pool_destroy(dyn_arr_pool *pool) {
+  dyn_arr_arena_destroy(&pool->chunks);
+  dyn_arr_pool_init(pool);
+}
+
+// Stable merge sort of count elements of size bytes, with qsort's compare.
+static inline void dyn_arr__merge(const char *left, size_t left_count, const char *right, size_t right_count,
+                                  char *to, size_t size, int (*compare)(const void *, const void *)) {
+  const char *left_end = left + left_count * size, *right_end = right + right_count * size;
+  while (left < left_end && right < right_end) {
+    // Ties take from the left, which keeps it stable.
+    if (compare(right, left) < 0) {
+      memcpy(to, right, size);
+      right += size;
+    } else {
+      memcpy(to, left, size);
+      left += size;
+    }
+    to += size;
+  }
+  memcpy(to, left, left_end - left);
+  to += left_end - left;
+  memcpy(to, right, right_end - right);
+}
+
+// Insertion sort for short runs; also stable.
+static inline void dyn_arr__insertion_sort(char *data, size_t count, size_t size, char *tmp,
+                                           int (*compare)(const void *, const void *)) {
+  for (size_t i = 1; i < count; ++i) {
+    size_t j = i;
+    memcpy(tmp, data + i * size, size);
+    while (j > 0 && compare(tmp, data + (j - 1) * size) < 0) {
+      memcpy(data + j * size, data + (j - 1) * size, size);
+      --j;
+    }
+    memcpy(data + j * size, tmp, size);
+  }
+}
+
+// Sorts data[0, count) in place, using spare for merging.
+static inline void dyn_arr__merge_sort(char *data, char *spare, size_t count, size_t size,
+                                       int (*compare)(const void *, const void *)) {
+  const size_t short_run = 16;
+  char *tmp = spare; // only used before any merging
+  for (size_t i = 0; i < count; i += short_run) {
+    size_t n = count - i < short_run ? count - i : short_run;
+    dyn_arr__insertion_sort(data + i * size, n, size, tmp, compare);
+  }
+  char *from = data, *to = spare;
+  for (size_t run = short_run; run < count; run *= 2) {
+    for (size_t i = 0; i < count; i += 2 * run) {
+      size_t left = count - i < run ? count - i : run;
+      size_t right = count - i - left < run ? count - i - left : run;
+      dyn_arr__merge(from + i * size, left, from + (i + left) * size, right, to + i * size, size, compare);
+    }
+    char *swap = from;
+    from = to;
+    to = swap;
+  }
+  if (from != data) memcpy(data, from, count * size);
+}
+
+static inline void dyn_arr_sort(void *data, size_t count, size_t size, int (*compare)(const void *, const void *)) {
+  if (count < 2) return;
+  char *spare = (char *)malloc(count * size);
+  assert(spare != NULL);
+  dyn_arr__merge_sort((char *)data, spare, count, size, compare);
+  free(spare);
+}
+
+#define DYN_ARR_SORT(a, compare) \
+  dyn_arr_sort(a.data, DYN_ARR_SIZE(a), sizeof(a.data[0]), (compare))
+
+// Struct-of-arrays: DYN_SOA_OF(name, (type, field), ...) defines struct name,
+// with one array per field, all sharing a size and capacity, so a loop over
+// one field reads nothing else and vectorizes. Each column is 64-byte
+// aligned, and they all live in one allocation. A zeroed one is empty.
+// Use at file scope (up to 16 fields); it also defines
+//   name_reserve(a, n)  room for n rows, exactly
+//   name_resize(a, n)   n rows, new ones uninitialized
+//   name_append(a, field values...)
+//   name_destroy(a)
+// and a->field is the column for a field.
+#define DYN_SOA_ALIGN 64u
+#define DYN_SOA__ROUND(n) (((n) + (DYN_SOA_ALIGN - 1u)) & ~(size_t)(DYN_SOA_ALIGN - 1u))
+
+#define DYN_SOA__FOR_EACH(m, ...) \
+  DYN_SOA__SELECT(__VA_ARGS__, DYN_SOA__FE16, DYN_SOA__FE15, DYN_SOA__FE14, DYN_SOA__FE13, DYN_SOA__FE12, DYN_SOA__FE11, DYN_SOA__FE10, DYN_SOA__FE9, DYN_SOA__FE8, DYN_SOA__FE7, DYN_SOA__FE6, DYN_SOA__FE5, DYN_SOA__FE4, DYN_SOA__FE3, DYN_SOA__FE2, DYN_SOA__FE1)(m, __VA_ARGS__)
+#define DYN_SOA__SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, fe, ...) fe
+#define DYN_SOA__FE1(m, x) m x
+#define DYN_SOA__FE2(m, x, ...) m x DYN_SOA__FE1(m, __VA_ARGS__)
+#define DYN_SOA__FE3(m, x, ...) m x DYN_SOA__FE2(m, __VA_ARGS__)
+#define DYN_SOA__FE4(m, x, ...) m x DYN_SOA__FE3(m, __VA_ARGS__)
+#define DYN_SOA__FE5(m, x, ...) m x DYN_SOA__FE4(m, __VA_ARGS__)
+#define DYN_SOA__FE6(m, x, ...) m x DYN_SOA__FE5(m, __VA_ARGS__)
+#define DYN_SOA__FE7(m, x, ...) m x DYN_SOA__FE6(m, __VA_ARGS__)
+#define DYN_SOA__FE8(m, x, ...) m x DYN_SOA__FE7(m, __VA_ARGS__)
+#define DYN_SOA__FE9(m, x, ...) m x DYN_SOA__FE8(m, __VA_ARGS__)
+#define DYN_SOA__FE10(m, x, ...) m x DYN_SOA__FE9(m, __VA_ARGS__)
+#define DYN_SOA__FE11(m, x, ...) m x DYN_SOA__FE10(m, __VA_ARGS__)
+#define DYN_SOA__FE12(m, x, ...) m x DYN_SOA__FE11(m, __VA_ARGS__)
+#define DYN_SOA__FE13(m, x, ...) m x DYN_SOA__FE12(m, __VA_ARGS__)
+#define DYN_SOA__FE14(m, x, ...) m x DYN_SOA__FE13(m, __VA_ARGS__)
+#define DYN_SOA__FE15(m, x, ...) m x DYN_SOA__FE14(m, __VA_ARGS__)
+#define DYN_SOA__FE16(m, x, ...) m x DYN_SOA__FE15(m, __VA_ARGS__)
+
+#define DYN_SOA__COLUMN(type, field) type *field;
+#define DYN_SOA__ROW_SIZE(type, field) + sizeof(type)
+#define DYN_SOA__BYTES(type, field) dyn_soa_bytes += DYN_SOA__ROUND(sizeof(type) * n);
+#define DYN_SOA__MOVE(type, field) { \
+  type *dyn_soa_column = (type *)(dyn_soa_block + dyn_soa_offset); \
+  if (a->size > 0) memcpy(dyn_soa_column, a->field, sizeof(type) * a->size); \
+  a->field = dyn_soa_column; \
+  dyn_soa_offset += DYN_SOA__ROUND(sizeof(type) * n); \
+}
+#define DYN_SOA__PARAM(type, field) , type field
+#define DYN_SOA__STORE(type, field) a->field[a->size] = field;
+
+#define DYN_SOA_OF(name, ...) \
+typedef struct name { \
+  DYN_SOA__FOR_EACH(DYN_SOA__COLUMN, __VA_ARGS__) \
+  void *block; \
+  uint32_t size; \
+  uint32_t capacity; \
+} name; \
+\
+static inline void name##_reserve(name *a, uint32_t n) { \
+  if (n <= a->capacity) return; \
+  size_t dyn_soa_bytes = 0; \
+  DYN_SOA__FOR_EACH(DYN_SOA__BYTES, __VA_ARGS__) \
+  char *dyn_soa_block = (char *)aligned_alloc(DYN_SOA_ALIGN, dyn_soa_bytes); \
+  assert(dyn_soa_block != NULL); \
+  size_t dyn_soa_offset = 0; \
+  DYN_SOA__FOR_EACH(DYN_SOA__MOVE, __VA_ARGS__) \
+  free(a->block); \
+  a->block = dyn_soa_block; \
+  a->capacity = n; \
+} \
+\
+static inline void name##_resize(name *a, uint32_t n) { \
+  if (n > a->capacity) { \
+    name##_reserve(a, DYN_ARR_GROWTH(a->capacity, n, 0 DYN_SOA__FOR_EACH(DYN_SOA__ROW_SIZE, __VA_ARGS__))); \
+  } \
+  a->size = n; \
+} \
+\
+static inline void name##_append(name *a DYN_SOA__FOR_EACH(DYN_SOA__PARAM, __VA_ARGS__)) { \
+  if (a->size == a->capacity) { \
+    name##_reserve(a, DYN_ARR_GROWTH(a->capacity, (size_t)a->capacity + 1u, \
+      0 DYN_SOA__FOR_EACH(DYN_SOA__ROW_SIZE, __VA_ARGS__))); \
+  } \
+  DYN_SOA__FOR_EACH(DYN_SOA__STORE, __VA_ARGS__) \
+  ++a->size; \
+} \
+\
+static inline void name##_destroy(name *a) { \
+  free(a->block); \
+  memset(a, 0, sizeof(*a)); \
+}
+
+#define DYN_SOA_SIZE(a) ((a).size)
+
+#define DYN_SOA_FOREACH(a, countername) \
+for (size_t countername = 0; (countername) < DYN_SOA_SIZE(a); ++(countername))
+
+// For many threads appending at once, without a lock: DYN_ARR_CONC_APPEND
+// claims a slot with an atomic add, and elements live in segments that
+// double in size and never move, so appends don't wait for each other and
+// growing never copies. Readers see a consistent prefix: every element below
+// DYN_ARR_CONC_PUBLISHED has been fully written. A zeroed one is empty, and
+// DESTROY must not race with anything. Needs GCC/Clang __atomic builtins.
+#if !defined(DYN_ARR_CONC_FIRST_SHIFT)
+#define DYN_ARR_CONC_FIRST_SHIFT 10u // the first segment holds 1 << this
+#endif
+#define DYN_ARR_CONC_SEGMENTS 32u
+
+#define DYN_ARR_CONC_OF(type) struct  { \
+  type *segments[DYN_ARR_CONC_SEGMENTS]; \
+  uint8_t *ready[DYN_ARR_CONC_SEGMENTS]; \
+  uint64_t reserved; \
+  uint64_t published; \
+}
+
+static inline unsigned dyn_arr__conc_segment(uint64_t i) {
+  return 63u - (unsigned)__builtin_clzll((i >> DYN_ARR_CONC_FIRST_SHIFT) + 1u);
+}
+
+static inline uint64_t dyn_arr__conc_offset(uint64_t i, unsigned segment) {
+  return i + ((uint64_t)1 << DYN_ARR_CONC_FIRST_SHIFT)
+    - ((uint64_t)1 << (DYN_ARR_CONC_FIRST_SHIFT + segment));
+}
+
+static inline size_t dyn_arr__conc_segment_size(unsigned segment) {
+  return (size_t)1 << (DYN_ARR_CONC_FIRST_SHIFT + segment);
+}
+
+// Returns segment *slot, allocating it first if no one has yet. Whoever
+// loses the race to install it frees theirs.
+static inline void *dyn_arr__conc_install(void **slot, size_t bytes, int zeroed) {
+  void *segment = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if (segment != NULL) return segment;
+  void *fresh = zeroed ? calloc(1, bytes) : malloc(bytes);
+  assert(fresh != NULL);
+  if (__atomic_compare_exchange_n(slot, &segment, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return fresh;
+  }
+  free(fresh);
+  return segment;
+}
+
+#define DYN_ARR_CONC_APPEND(a, v) { \
+  uint64_t dyn_arr_index = __atomic_fetch_add(&a.reserved, 1u, __ATOMIC_RELAXED); \
+  unsigned dyn_arr_segment = dyn_arr__conc_segment(dyn_arr_index); \
+  uint64_t dyn_arr_offset = dyn_arr__conc_offset(dyn_arr_index, dyn_arr_segment); \
+  size_t dyn_arr_count = dyn_arr__conc_segment_size(dyn_arr_segment); \
+  __typeof__(a.segments[0]) dyn_arr_elems = (__typeof__(a.segments[0]))dyn_arr__conc_install( \
+    (void **)&a.segments[dyn_arr_segment], sizeof(a.segments[0][0]) * dyn_arr_count, 0); \
+  uint8_t *dyn_arr_ready = (uint8_t *)dyn_arr__conc_install( \
+    (void **)&a.ready[dyn_arr_segment], dyn_arr_count, 1); \
+  dyn_arr_elems[dyn_arr_offset] = v; \
+  __atomic_store_n(&dyn_arr_ready[dyn_arr_offset], 1, __ATOMIC_RELEASE); \
+}
+
+// How many elements, from the start, are fully written. Moves published up
+// past any slots finished since the last call.
+static inline uint64_t dyn_arr__conc_published(uint8_t **ready, uint64_t *reserved, uint64_t *published) {
+  uint64_t n = __atomic_load_n(published, __ATOMIC_ACQUIRE);
+  uint64_t end = __atomic_load_n(reserved, __ATOMIC_RELAXED);
+  uint64_t start = n;
+  while (n < end) {
+    unsigned segment = dyn_arr__conc_segment(n);
+    uint8_t *flags = (uint8_t *)__atomic_load_n((void **)&ready[segment], __ATOMIC_ACQUIRE);
+    if (flags == NULL || !__atomic_load_n(&flags[dyn_arr__conc_offset(n, segment)], __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    ++n;
+  }
+  if (n > start) {
+    uint64_t seen = start;
+    while (seen < n && !__atomic_compare_exchange_n(published, &seen, n, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    }
+  }
+  return n;
+}
+
+#define DYN_ARR_CONC_PUBLISHED(a) \
+  dyn_arr__conc_published(a.ready, &a.reserved, &a.published)
+
+// Only for i below a DYN_ARR_CONC_PUBLISHED this thread has seen.
+#define DYN_ARR_CONC_AT(a, i) \
+  (a.segments[dyn_arr__conc_segment(i)][dyn_arr__conc_offset((i), dyn_arr__conc_segment(i))])
+
+#define DYN_ARR_CONC_FOREACH(a, countername) \
+for (uint64_t countername = 0, countername##_end = DYN_ARR_CONC_PUBLISHED(a); \
+     (countername) < countername##_end; ++(countername))
+
+#define DYN_ARR_CONC_DESTROY(a) { \
+  for (unsigned dyn_arr_segment = 0; dyn_arr_segment < DYN_ARR_CONC_SEGMENTS; ++dyn_arr_segment) { \
+    free(a.segments[dyn_arr_segment]); \
+    free(a.ready[dyn_arr_segment]); \
+    a.segments[dyn_arr_segment] = NULL; \
+    a.ready[dyn_arr_segment] = NULL; \
+  } \
+  a.reserved = a.published = 0; \
+}
+
+// For latency-sensitive appends: when an array is full, it moves to a buffer
+// twice the size, but the elements are copied over a few at a time on the
+// following appends instead of all at once, so no append copies more than
+// DYN_ARR_INCR_STEP elements. Until then the first `pending` elements are
+// still in the old buffer, so read and write them with DYN_ARR_INCR_AT
+// rather than DYN_ARR_AT, or call DYN_ARR_INCR_FINISH first. Likewise use
+// DYN_ARR_INCR_BACKPTR rather than DYN_ARR_BACKPTR: after pops, the last
+// element can still be pending. SIZE, EMPTY and FOREACH work as usual.
+// Memory comes from the allocator given to DYN_ARR_INCR_RESET_WITH, like
+// DYN_ARR_OF's, and instrumented builds count resets, growth and DESTROY.
+#define DYN_ARR_INCR_OF(type) struct  { \
+  type *data; \
+  type *endptr; \
+  uint32_t capacity; \
+  uint32_t pending; \
+  type *old; \
+  uint32_t old_capacity; \
+  dyn_arr_allocator *allocator; \
+}
+
+#if !defined(DYN_ARR_INCR_STEP)
+#define DYN_ARR_INCR_STEP 4u
+#endif
+
+#define DYN_ARR_INCR_RESET(a, c) DYN_ARR_INCR_RESET_WITH(a, c, NULL)
+
+#define DYN_ARR_INCR_RESET_WITH(a, c, alloc) { \
+  a.allocator = (alloc); \
+  a.data = (decltype(a.data))dyn_arr__resize(a.allocator, NULL, 0, sizeof(a.data[0]) * (c)); \
+  assert(a.data != NULL || (c) == 0); \
+  a.endptr = a.data; \
+  a.capacity = (c); \
+  a.pending = 0; \
+  a.old = NULL; \
+  a.old_capacity = 0; \
+  DYN_ARR__ON_RESET(a); \
+}
+
+#define DYN_ARR_INCR_AT(a, i) \
+  (*((size_t)(i) < a.pending ? &a.old[i] : &a.data[i]))
+
+#define DYN_ARR_INCR_BACKPTR(a) (&DYN_ARR_INCR_AT(a, DYN_ARR_SIZE(a) - 1u))
+
+// Gives back the old buffer, once nothing is pending in it.
+#define DYN_ARR__INCR_DROP_OLD(a) { \
+  dyn_arr__release(a.allocator, a.old, sizeof(a.data[0]) * a.old_capacity); \
+  a.old = NULL; \
+  a.old_capacity = 0; \
+  a.pending = 0; \
+}
+
+// Copies up to n pending elements into the new buffer, last first.
+#define DYN_ARR__INCR_MIGRATE(a, n) { \
+  uint32_t dyn_arr_step = a.pending < (n) ? a.pending : (n); \
+  a.pending -= dyn_arr_step; \
+  memcpy(a.data + a.pending, a.old + a.pending, sizeof(a.data[0]) * dyn_arr_step); \
+  if (a.pending == 0) DYN_ARR__INCR_DROP_OLD(a); \
+}
+
+#define DYN_ARR_INCR_FINISH(a) { \
+  if (a.pending > 0) DYN_ARR__INCR_MIGRATE(a, a.pending); \
+}
+
+// Starts moving to a buffer twice the size. With at least one element
+// migrated per append, the old buffer is empty before the new one fills.
+// The new buffer is always a separate allocation, even from an arena that
+// could have grown the old one in place.
+#define DYN_ARR__INCR_GROW(a) { \
+  DYN_ARR_INCR_FINISH(a); \
+  uint32_t dyn_arr_size = DYN_ARR_SIZE(a); \
+  uint32_t dyn_arr_capacity = dyn_arr_grow_double(a.capacity, (size_t)a.capacity + 1u, sizeof(a.data[0])); \
+  decltype(a.data) dyn_arr_tmp = (decltype(a.data))dyn_arr__resize(a.allocator, NULL, 0, \
+    sizeof(a.data[0]) * dyn_arr_capacity); \
+  assert(dyn_arr_tmp != NULL); \
+  decltype(a.data) dyn_arr_old = a.data; \
+  (void)dyn_arr_old; \
+  if (dyn_arr_size > 0) { \
+    a.old = a.data; \
+    a.old_capacity = a.capacity; \
+    a.pending = dyn_arr_size; \
+  } else { \
+    dyn_arr__release(a.allocator, a.data, sizeof(a.data[0]) * a.capacity); \
+  } \
+  a.data = dyn_arr_tmp; \
+  a.endptr = a.data + dyn_arr_size; \
+  a.capacity = dyn_arr_capacity; \
+  DYN_ARR__ON_REALLOC(a, dyn_arr_old, dyn_arr_size); \
+}
+
+#define DYN_ARR_INCR_APPEND(a, v) { \
+  if (a.endptr == a.data + a.capacity) { \
+    DYN_ARR__INCR_GROW(a); \
+  } \
+  if (a.pending > 0) DYN_ARR__INCR_MIGRATE(a, DYN_ARR_INCR_STEP); \
+  *(a.endptr++) = v; \
+}
+
+#define DYN_ARR_INCR_POP(a) { \
+  DYN_ARR_POP(a); \
+  if (a.pending > DYN_ARR_SIZE(a)) a.pending = DYN_ARR_SIZE(a); \
+}
+
+#define DYN_ARR_INCR_CLEAR(a) { \
+  if (a.old != NULL) DYN_ARR__INCR_DROP_OLD(a); \
+  a.endptr = a.data; \
+}
+
+#define DYN_ARR_INCR_DESTROY(a) if (a.data != NULL) { \
+  DYN_ARR__ON_DESTROY(a); \
+  DYN_ARR_INCR_CLEAR(a); \
+  dyn_arr__release(a.allocator, a.data, sizeof(a.data[0]) * a.capacity); \
+  a.data = a.endptr = NULL; \
+  a.capacity = 0; \
+}
+
+// Strict ISO modes hide MAP_ANONYMOUS; these need _DEFAULT_SOURCE or similar.
+#if defined(MAP_ANONYMOUS)
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+
+// For huge arrays: reserves address space for up to a fixed number of
+// elements up front, and commits pages as the array grows. Growing never
+// copies, pointers to elements stay valid, and sizes are 64-bit. Use the
+// DYN_ARR_VM_ macros to set up, grow and destroy one, and DYN_ARR_AT, POP,
+// CLEAR, EMPTY and BACKPTR as usual.
+#define DYN_ARR_VM_OF(type) struct  { \
+  type *data; \
+  type *endptr; \
+  uint64_t capacity; /* committed */ \
+  uint64_t reserved; \
+  uint32_t flags; \
+}
+
+// Asks for transparent huge pages, and commits 2 MB at a time.
+#define DYN_ARR_VM_HUGE_PAGES 2u
+
+#define DYN_ARR_VM_HUGE_PAGE_SIZE ((size_t)2u << 20)
+
+static inline size_t dyn_arr__vm_page(uint32_t flags) {
+  if (flags & DYN_ARR_VM_HUGE_PAGES) return DYN_ARR_VM_HUGE_PAGE_SIZE;
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static inline void *dyn_arr__vm_reserve(size_t bytes, uint32_t flags) {
+  if (bytes == 0) return NULL;
+  void *base = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) return NULL;
+#if defined(MADV_HUGEPAGE)
+  if (flags & DYN_ARR_VM_HUGE_PAGES) madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+  return base;
+}
+
+// Running out of reserved or committable memory isn't a bug the caller can
+// assert away, and carrying on would write past the mapping, so these are
+// checked in every build.
+static inline void dyn_arr__vm_fail(const char *what) {
+  perror(what);
+  abort();
+}
+
+// Commits at least needed bytes of the reservation (doubling, in whole
+// pages), and returns how many are committed now.
+static inline size_t dyn_arr__vm_commit(void *base, size_t committed, size_t needed, size_t reserved, uint32_t flags) {
+  if (needed > reserved) {
+    errno = ENOMEM;
+    dyn_arr__vm_fail("dyn_arr: DYN_ARR_VM array grew past its reservation");
+  }
+  size_t page = dyn_arr__vm_page(flags);
+  size_t bytes = committed * 2u > needed ? committed * 2u : needed;
+  bytes = (bytes + page - 1u) / page * page;
+  if (bytes > reserved) bytes = reserved;
+  if (mprotect((char *)base + committed, bytes - committed, PROT_READ | PROT_WRITE) != 0) {
+    dyn_arr__vm_fail("dyn_arr: can't commit DYN_ARR_VM pages");
+  }
+  return bytes;
+}
+
+// Gives pages past kept bytes back to the OS, keeping them reserved.
+static inline size_t dyn_arr__vm_decommit(void *base, size_t committed, size_t kept, uint32_t flags) {
+  size_t page = dyn_arr__vm_page(flags);
+  kept = (kept + page - 1u) / page * page;
+  if (kept >= committed) return committed;
+#if defined(MADV_DONTNEED)
+  madvise((char *)base + kept, committed - kept, MADV_DONTNEED);
+#endif
+  mprotect((char *)base + kept, committed - kept, PROT_NONE);
+  return kept;
+}
+
+// Reserves room for max_count elements. vm_flags can be DYN_ARR_VM_HUGE_PAGES.
+#define DYN_ARR_VM_RESET(a, max_count, vm_flags) { \
+  a.flags = (vm_flags); \
+  size_t dyn_arr_page = dyn_arr__vm_page(a.flags); \
+  size_t dyn_arr_bytes = ((size_t)(max_count) * sizeof(a.data[0]) + dyn_arr_page - 1u) / dyn_arr_page * dyn_arr_page; \
+  a.data = (decltype(a.data))dyn_arr__vm_reserve(dyn_arr_bytes, a.flags); \
+  if (a.data == NULL && dyn_arr_bytes > 0) dyn_arr__vm_fail("dyn_arr: can't reserve DYN_ARR_VM space"); \
+  a.endptr = a.data; \
+  a.capacity = 0; \
+  a.reserved = dyn_arr_bytes / sizeof(a.data[0]); \
+}
+
+// Commits room for at least n elements in total.
+#define DYN_ARR_VM_RESERVE(a, n) { \
+  uint64_t dyn_arr_needed = (n); \
+  if (dyn_arr_needed > a.capacity) { \
+    a.capacity = dyn_arr__vm_commit(a.data, a.capacity * sizeof(a.data[0]), \
+      dyn_arr_needed * sizeof(a.data[0]), a.reserved * sizeof(a.data[0]), a.flags) / sizeof(a.data[0]); \
+  } \
+}
+
+#define DYN_ARR_VM_APPEND(a, v) { \
+  if (a.endptr == a.data + a.capacity) { \
+    DYN_ARR_VM_RESERVE(a, a.capacity + 1u); \
+  } \
+  *(a.endptr++) = v; \
+}
+
+#define DYN_ARR_VM_APPEND_N(a, src, n) { \
+  size_t dyn_arr_count = (n); \
+  DYN_ARR_VM_RESERVE(a, DYN_ARR_VM_SIZE(a) + dyn_arr_count); \
+  memcpy(a.endptr, (src), sizeof(a.data[0]) * dyn_arr_count); \
+  a.endptr += dyn_arr_count; \
+}
+
+#define DYN_ARR_VM_RESIZE(a, s) { \
+  uint64_t dyn_arr_new_size = (s); \
+  DYN_ARR_VM_RESERVE(a, dyn_arr_new_size); \
+  a.endptr = a.data + dyn_arr_new_size; \
+}
+
+#define DYN_ARR_VM_SHRINK_TO_FIT(a) { \
+  a.capacity = dyn_arr__vm_decommit(a.data, a.capacity * sizeof(a.data[0]), \
+    DYN_ARR_VM_SIZE(a) * sizeof(a.data[0]), a.flags) / sizeof(a.data[0]); \
+}
+
+#define DYN_ARR_VM_DESTROY(a) if(a.data != NULL) { \
+  munmap(a.data, a.reserved * sizeof(a.data[0])); \
+  a.data = a.endptr = NULL; \
+  a.capacity = a.reserved = 0; \
+}
+
+#define DYN_ARR_VM_SIZE(a) ((uint64_t)(a.endptr - a.data))
+
+#define DYN_ARR_VM_FOREACH(a, countername) \
+for (uint64_t countername = 0; (countername) < DYN_ARR_VM_SIZE(a); ++(countername))
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+// Saving an array to a file, and mapping it back later without reading or
+// copying it: DYN_ARR_SAVE writes a header and the elements as they are in
+// memory, and DYN_ARR_MAP points an array straight at the file's pages.
+// The file is only good on machines with the same layout for the type.
+//
+// A mapped array is read-only (writing faults) or copy-on-write (writes
+// stay private to the process), and behaves like an inline one otherwise:
+// growing copies it to the heap, and DYN_ARR_DESTROY unmaps it.
+#define DYN_ARR_FILE_MAGIC 0x5252414e5944ull // "DYNARR"
+#define DYN_ARR_FILE_VERSION 1u
+
+typedef struct dyn_arr_file_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t elem_size;
+  uint64_t count;
+  uint64_t checksum; // of the elements' bytes
+  uint8_t reserved[DYN_ARR_FILE_HEADER_SIZE - 32];
+} dyn_arr_file_header;
+
+enum {
+  DYN_ARR_MAP_READ_ONLY = 0,
+  DYN_ARR_MAP_COPY_ON_WRITE = 1,
+  // Also checks the checksum, which reads the whole file.
+  DYN_ARR_MAP_VERIFY = 2,
+};
+
+enum {
+  DYN_ARR_FILE_OK = 0,
+  DYN_ARR_FILE_IO_ERROR = -1,       // see errno
+  DYN_ARR_FILE_BAD_HEADER = -2,     // not a saved array, or another version
+  DYN_ARR_FILE_ELEM_SIZE = -3,      // saved with a different element size
+  DYN_ARR_FILE_BAD_SIZE = -4,       // truncated, or too many elements
+  DYN_ARR_FILE_BAD_CHECKSUM = -5,
+};
+
+static inline uint64_t dyn_arr_checksum(const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    h = (h ^ word) * 0xff51afd7ed558ccdull;
+    h ^= h >> 29;
+  }
+  for (; i < size; ++i) {
+    h = (h ^ bytes[i]) * 0xc4ceb9fe1a85ec53ull;
+  }
+  return h ^ (h >> 32);
+}
+
+static inline int dyn_arr__write_all(int fd, const void *data, size_t size) {
+  const char *bytes = (const char *)data;
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written < 0) return 0;
+    bytes += written;
+    size -= (size_t)written;
+  }
+  return 1;
+}
+
+// Writes to path.tmp and renames it over path, so a reader never maps a
+// half-written file.
+static inline int dyn_arr_save(const char *path, const void *data, size_t count, size_t elem_size) {
+  dyn_arr_file_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = DYN_ARR_FILE_MAGIC;
+  header.version = DYN_ARR_FILE_VERSION;
+  header.elem_size = (uint32_t)elem_size;
+  header.count = count;
+  header.checksum = dyn_arr_checksum(data, count * elem_size);
+
+  size_t path_len = strlen(path);
+  char *tmp_path = (char *)malloc(path_len + 5);
+  if (tmp_path == NULL) return DYN_ARR_FILE_IO_ERROR;
+  memcpy(tmp_path, path, path_len);
+  memcpy(tmp_path + path_len, ".tmp", 5);
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int ok = fd >= 0
+    && dyn_arr__write_all(fd, &header, sizeof(header))
+    && dyn_arr__write_all(fd, data, count * elem_size);
+  if (fd >= 0 && close(fd) != 0) ok = 0;
+  if (ok) ok = rename(tmp_path, path) == 0;
+  if (!ok) unlink(tmp_path);
+  free(tmp_path);
+  return ok ? DYN_ARR_FILE_OK : DYN_ARR_FILE_IO_ERROR;
+}
+
+// Maps a file written by dyn_arr_save, and points *data at its elements.
+static inline int dyn_arr_map(const char *path, size_t elem_size, int mode, void **data, uint64_t *count) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return DYN_ARR_FILE_IO_ERROR;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return DYN_ARR_FILE_IO_ERROR;
+  }
+  if ((uint64_t)st.st_size < DYN_ARR_FILE_HEADER_SIZE) {
+    close(fd);
+    return DYN_ARR_FILE_BAD_HEADER;
+  }
+  int prot = PROT_READ | ((mode & DYN_ARR_MAP_COPY_ON_WRITE) ? PROT_WRITE : 0);
+  int flags = (mode & DYN_ARR_MAP_COPY_ON_WRITE) ? MAP_PRIVATE : MAP_SHARED;
+  void *base = mmap(NULL, (size_t)st.st_size, prot, flags, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return DYN_ARR_FILE_IO_ERROR;
+
+  const dyn_arr_file_header *header = (const dyn_arr_file_header *)base;
+  int status = DYN_ARR_FILE_OK;
+  if (header->magic != DYN_ARR_FILE_MAGIC || header->version != DYN_ARR_FILE_VERSION) {
+    status = DYN_ARR_FILE_BAD_HEADER;
+  } else if (header->elem_size != elem_size) {
+    status = DYN_ARR_FILE_ELEM_SIZE;
+  } else if (header->count > UINT32_MAX
+             || (uint64_t)st.st_size != DYN_ARR_FILE_HEADER_SIZE + header->count * elem_size) {
+    status = DYN_ARR_FILE_BAD_SIZE;
+  } else if ((mode & DYN_ARR_MAP_VERIFY)
+             && dyn_arr_checksum((const char *)base + DYN_ARR_FILE_HEADER_SIZE, header->count * elem_size)
+                != header->checksum) {
+    status = DYN_ARR_FILE_BAD_CHECKSUM;
+  }
+  if (status != DYN_ARR_FILE_OK) {
+    munmap(base, (size_t)st.st_size);
+    return status;
+  }
+  *data = (char *)base + DYN_ARR_FILE_HEADER_SIZE;
+  *count = header->count;
+  return DYN_ARR_FILE_OK;
+}
+
+#define DYN_ARR_SAVE(a, path) \
+  dyn_arr_save((path), a.data, DYN_ARR_SIZE(a), sizeof(a.data[0]))
+
+// Replaces a (which should be empty or destroyed) with the saved array at
+// path, and sets status to one of the DYN_ARR_FILE_ codes. mode is
+// DYN_ARR_MAP_READ_ONLY or DYN_ARR_MAP_COPY_ON_WRITE, optionally with
+// DYN_ARR_MAP_VERIFY.
+#define DYN_ARR_MAP(a, path, mode, status) { \
+  void *dyn_arr_mapped; \
+  uint64_t dyn_arr_count; \
+  (status) = dyn_arr_map((path), sizeof(a.data[0]), (mode), &dyn_arr_mapped, &dyn_arr_count); \
+  if ((status) == DYN_ARR_FILE_OK) { \
+    a.data = (decltype(a.data))dyn_arr_mapped; \
+    a.endptr = a.data + dyn_arr_count; \
+    a.capacity = (uint32_t)dyn_arr_count; \
+    a.flags = DYN_ARR_FLAG_MAPPED; \
+    a.allocator = NULL; \
+  } \
+}
+#endif
+
+#if defined(__cplusplus)
+#include <new>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+// Whether a T can be moved in memory with realloc/memcpy. Specialize this for
+// types that can, even though they aren't trivially copyable (most types that
+// don't point into themselves).
+template <class T>
+struct dyn_arr_is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// The same layout as DYN_ARR_OF(T), so C and C++ can share arrays: of() gives
+// a DYN_ARR_OF(T) as a DynArray<T>, and the DYN_ARR_ macros work on a
+// DynArray<T> as long as T is trivially relocatable. Memory comes from the
+// same allocators, and grows by DYN_ARR_GROWTH.
+template <class T>
+struct DynArray {
+  T *data = nullptr;
+  T *endptr = nullptr;
+  uint32_t capacity = 0;
+  uint32_t flags = 0;
+  dyn_arr_allocator *allocator = nullptr;
+
+  static_assert(alignof(T) <= DYN_ARR_ALIGN, "DynArray can't align T");
+
+  DynArray() = default;
+  explicit DynArray(dyn_arr_allocator *alloc) : allocator(alloc) {}
+
+  DynArray(const DynArray &other) : allocator(other.allocator) {
+    reserve(other.size());
+    for (const T &value : other) new (endptr++) T(value);
+  }
+
+  DynArray(DynArray &&other) noexcept
+    : data(other.data), endptr(other.endptr), capacity(other.capacity),
+      flags(other.flags), allocator(other.allocator) {
+    other.data = other.endptr = nullptr;
+    other.capacity = 0;
+    other.flags = 0;
+  }
+
+  DynArray &operator=(const DynArray &other) {
+    if (this != &other) {
+      clear();
+      reserve(other.size());
+      for (const T &value : other) new (endptr++) T(value);
+    }
+    return *this;
+  }
+
+  DynArray &operator=(DynArray &&other) noexcept {
+    if (this != &other) {
+      destroy();
+      data = other.data;
+      endptr = other.endptr;
+      capacity = other.capacity;
+      flags = other.flags;
+      allocator = other.allocator;
+      other.data = other.endptr = nullptr;
+      other.capacity = 0;
+      other.flags = 0;
+    }
+    return *this;
+  }
+
+  ~DynArray() { destroy(); }
+
+  template <class A>
+  static DynArray &of(A &a) {
+    static_assert(std::is_same<decltype(a.data), T *>::value && sizeof(A) == sizeof(DynArray),
+                  "of() needs a DYN_ARR_OF(T)");
+    return *reinterpret_cast<DynArray *>(&a);
+  }
+
+  uint32_t size() const { return (uint32_t)(endptr - data); }
+  bool empty() const { return endptr == data; }
+
+  T *begin() { return data; }
+  T *end() { return endptr; }
+  const T *begin() const { return data; }
+  const T *end() const { return endptr; }
+
+  T &operator[](size_t i) { return data[i]; }
+  const T &operator[](size_t i) const { return data[i]; }
+  T &back() { return endptr[-1]; }
+  const T &back() const { return endptr[-1]; }
+
+#if __cplusplus >= 202002L
+  std::span<T> span() { return {data, size()}; }
+  std::span<const T> span() const { return {data, size()}; }
+#endif
+
+  // Allocates exactly n, if there isn't room for n already.
+  void reserve(size_t n) {
+    if (n > capacity) reallocate(n);
+  }
+
+  template <class... Args>
+  T &emplace_back(Args &&...args) {
+    if (endptr == data + capacity) {
+      // args may refer to an element, which growing would move.
+      T value(std::forward<Args>(args)...);
+      reallocate(DYN_ARR_GROWTH(capacity, (size_t)capacity + 1u, sizeof(T)));
+      return *new (endptr++) T(std::move(value));
+    }
+    return *new (endptr++) T(std::forward<Args>(args)...);
+  }
+
+  void push_back(const T &value) { emplace_back(value); }
+  void push_back(T &&value) { emplace_back(std::move(value)); }
+
+  void pop_back() {
+    assert(!empty());
+    (--endptr)->~T();
+  }
+
+  void resize(size_t n) {
+    reserve(n);
+    while (size() > n) pop_back();
+    while (size() < n) new (endptr++) T();
+  }
+
+  void clear() {
+    while (!empty()) pop_back();
+  }
+
+  void shrink_to_fit() {
+    if (size() < capacity && !(flags & DYN_ARR_FLAG_BORROWED)) reallocate(size());
+  }
+
+private:
+  void destroy() {
+    clear();
+    if (flags & DYN_ARR_FLAG_BORROWED) {
+      dyn_arr__drop_borrowed(flags, data, sizeof(T) * capacity);
+    } else if (data != nullptr) {
+      dyn_arr__release(allocator, data, sizeof(T) * capacity);
+    }
+    data = endptr = nullptr;
+    capacity = 0;
+    flags = 0;
+  }
+
+  void reallocate(size_t n) {
+    assert(n >= size() && n <= UINT32_MAX);
+    uint32_t count = size();
+    T *fresh;
+    if (dyn_arr_is_trivially_relocatable<T>::value && !(flags & DYN_ARR_FLAG_BORROWED)) {
+      if (n == 0) {
+        dyn_arr__release(allocator, data, sizeof(T) * capacity);
+        fresh = nullptr;
+      } else {
+        fresh = (T *)dyn_arr__resize(allocator, data, sizeof(T) * capacity, sizeof(T) * n);
+        if (fresh == nullptr) throw std::bad_alloc();
+      }
+    } else {
+      fresh = n == 0 ? nullptr : (T *)dyn_arr__resize(allocator, nullptr, 0, sizeof(T) * n);
+      if (fresh == nullptr && n != 0) throw std::bad_alloc();
+      for (uint32_t i = 0; i < count; ++i) {
+        new (fresh + i) T(std::move(data[i]));
+        data[i].~T();
+      }
+      if (flags & DYN_ARR_FLAG_BORROWED) {
+        dyn_arr__drop_borrowed(flags, data, sizeof(T) * capacity);
+      } else if (data != nullptr) {
+        dyn_arr__release(allocator, data, sizeof(T) * capacity);
+      }
+      flags &= ~DYN_ARR_FLAG_BORROWED;
+    }
+    data = fresh;
+    endptr = fresh + count;
+    capacity = (uint32_t)n;
+  }
+};
+
+// of() and the DYN_ARR_ macros rely on this. The element type only changes
+// what data and endptr point at, so one type checks them all.
+typedef DYN_ARR_OF(int) dyn_arr__c_layout;
+static_assert(sizeof(DynArray<int>) == sizeof(dyn_arr__c_layout)
+              && alignof(DynArray<int>) == alignof(dyn_arr__c_layout)
+              && offsetof(DynArray<int>, data) == offsetof(dyn_arr__c_layout, data)
+              && offsetof(DynArray<int>, endptr) == offsetof(dyn_arr__c_layout, endptr)
+              && offsetof(DynArray<int>, capacity) == offsetof(dyn_arr__c_layout, capacity)
+              && offsetof(DynArray<int>, flags) == offsetof(dyn_arr__c_layout, flags)
+              && offsetof(DynArray<int>, allocator) == offsetof(dyn_arr__c_layout, allocator),
+              "DynArray<T> must have the layout of DYN_ARR_OF(T)");
+#endif
+
 /*
  Example usage:
   typedef struct point { uint32_t x, y } point;
@@ -76,8 +1454,48 @@ for (size_t countername = 0; (countername) < DYN_ARR_SIZE(a); ++(countername))
       assert(DYN_ARR_AT(points, i).x == i);
       assert(DYN_ARR_AT(points, i).y == i * 10u);
     }
+
+    point more[50];
+    ...
+    DYN_ARR_APPEND_N(points, more, 50u);
+    point *fresh;
+    DYN_ARR_EXTEND_UNINIT(points, 10u, fresh);
+    for (uint32_t i = 0u; i < 10u; ++i) {
+      fresh[i] = (point){0u, 0u};
+    }
+    assert(DYN_ARR_SIZE(points) == 260u);
     DYN_ARR_CLEAR(points);
     assert(DYN_ARR_SIZE(points) == 0u);
+    DYN_ARR_SHRINK_TO_FIT(points);
     DYN_ARR_DESTROY(points);
   }
+
+  void bar() {
+    // No malloc unless it gets past 16 points.
+    DYN_ARR_SMALL_OF(point, 16) points;
+    DYN_ARR_SMALL_RESET(points);
+    ...
+    DYN_ARR_DESTROY(points);
+  }
+
+  // A point per row, but xs and ys each contiguous: summing xs reads no ys.
+  DYN_SOA_OF(points_soa, (uint32_t, x), (uint32_t, y))
+  uint64_t sum_x(const points_soa *points) {
+    uint64_t sum = 0;
+    DYN_SOA_FOREACH(*points, i) sum += points->x[i];
+    return sum;
+  }
+
+  void handle_request(dyn_arr_arena *arena) {
+    // Everything here is freed by one dyn_arr_arena_reset(arena) after the
+    // request, so DYN_ARR_DESTROY has nothing to do.
+    DYN_ARR_OF(point) points;
+    DYN_ARR_RESET_WITH(points, 0u, &arena->allocator);
+    ...
+  }
+
+  // With DYN_ARR_INSTRUMENT defined to 1 before the include, at exit:
+  DYN_ARR_INSTRUMENT_REPORT(stderr);
+  // site                 resets reallocs destroys bytes copied ...
+  // server.c:120              0      612        0     20970240 ...
 */
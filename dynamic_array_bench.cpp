@@ -0,0 +1,620 @@
+// Benchmarks for dynamic_array.h, dynamic_array_parallel.h and
+// dynamic_array_map.h, mostly side by side with the std:: equivalent.
+// Build with optimizations:
+//
+//   c++ -O2 -std=c++17 -pthread dynamic_array_bench.cpp -o dynamic_array_bench
+//   ./dynamic_array_bench [--runs N] [--seed S] [--json results.json] [filter...]
+//
+// Each benchmark runs once to warm up and then --runs times (21 by default),
+// and prints percentiles over the runs of the time per operation. The
+// latency ones time every operation instead, for the tail. Only benchmarks
+// whose names contain one of the filters run, if there are any. Inputs come
+// from --seed, so two builds see the same data: save a --json file from
+// each and compare. process_args is measured by "multiargmacro bench",
+// which writes the same format.
+
+#include "dynamic_array.h"
+#include "dynamic_array_map.h"
+#include "dynamic_array_parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static int runs = 21;
+static uint64_t seed = 42;
+static std::vector<std::string> filters;
+
+struct bench_result {
+  std::string name;
+  const char *unit;
+  std::vector<double> samples;
+};
+
+static std::vector<bench_result> results;
+
+static uint64_t splitmix64(uint64_t &state) {
+  uint64_t x = (state += 0x9e3779b97f4a7c15ull);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// count numbers from the seed, distinct streams for distinct salts.
+static std::vector<uint64_t> random_values(size_t count, uint64_t salt) {
+  uint64_t state = seed ^ (salt * 0xd1b54a32d192ed03ull);
+  std::vector<uint64_t> values(count);
+  for (uint64_t &value : values) value = splitmix64(state);
+  return values;
+}
+
+// Stops the compiler from dropping work whose result is otherwise unused.
+template <typename T>
+static inline void keep(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+static double now_ns() {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool wanted(const std::string &name) {
+  if (filters.empty()) return true;
+  for (const std::string &filter : filters) {
+    if (name.find(filter) != std::string::npos) return true;
+  }
+  return false;
+}
+
+// Nearest rank, of sorted samples.
+static double percentile(const std::vector<double> &samples, double p) {
+  size_t rank = (size_t)(p * (double)samples.size());
+  return samples[rank < samples.size() ? rank : samples.size() - 1];
+}
+
+static void report(bench_result result) {
+  std::sort(result.samples.begin(), result.samples.end());
+  const std::vector<double> &s = result.samples;
+  printf("%-44s %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f  %s\n", result.name.c_str(), s.front(),
+         percentile(s, 0.5), percentile(s, 0.9), percentile(s, 0.99), percentile(s, 0.999), s.back(),
+         result.unit);
+  fflush(stdout);
+  results.push_back(std::move(result));
+}
+
+// Times body, which does ops operations, after setup, which isn't timed.
+template <typename Setup, typename Body>
+static void bench(const std::string &name, double ops, Setup setup, Body body) {
+  if (!wanted(name)) return;
+  bench_result result = {name, "ns/op", {}};
+  setup();
+  body();
+  for (int run = 0; run < runs; ++run) {
+    setup();
+    double start = now_ns();
+    body();
+    result.samples.push_back((now_ns() - start) / ops);
+  }
+  report(std::move(result));
+}
+
+template <typename Body>
+static void bench(const std::string &name, double ops, Body body) {
+  bench(name, ops, [] {}, body);
+}
+
+// body(samples) adds the time each of its operations took, clock reads
+// included.
+template <typename Body>
+static void bench_latency(const std::string &name, Body body) {
+  if (!wanted(name)) return;
+  bench_result result = {name, "ns", {}};
+  std::vector<double> warmup;
+  body(warmup);
+  for (int run = 0; run < runs; ++run) body(result.samples);
+  report(std::move(result));
+}
+
+static void write_json(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    return;
+  }
+  fprintf(out, "{\n  \"seed\": %llu,\n  \"runs\": %d,\n  \"results\": [", (unsigned long long)seed, runs);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const bench_result &r = results[i];
+    const std::vector<double> &s = r.samples;
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": %zu, \"min\": %.3f, "
+            "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+            i > 0 ? "," : "", r.name.c_str(), r.unit, s.size(), s.front(), percentile(s, 0.5),
+            percentile(s, 0.9), percentile(s, 0.99), percentile(s, 0.999), s.back());
+  }
+  fprintf(out, "\n  ]\n}\n");
+  fclose(out);
+}
+
+static const uint32_t N = 1u << 20;
+
+static void bench_append() {
+  std::vector<uint64_t> input = random_values(N, 1);
+  for (uint32_t start : {0u, 16u, 1024u, (uint32_t)N}) {
+    std::string suffix = "/start=" + std::to_string(start);
+    bench("append/dyn_arr" + suffix, N, [&] {
+      DYN_ARR_OF(uint32_t) a;
+      DYN_ARR_RESET(a, start);
+      for (uint32_t i = 0; i < N; ++i) DYN_ARR_APPEND(a, (uint32_t)input[i]);
+      keep(a.data);
+      DYN_ARR_DESTROY(a);
+    });
+    bench("append/DynArray" + suffix, N, [&] {
+      DynArray<uint32_t> a;
+      a.reserve(start);
+      for (uint32_t i = 0; i < N; ++i) a.push_back((uint32_t)input[i]);
+      keep(a.data);
+    });
+    bench("append/std_vector" + suffix, N, [&] {
+      std::vector<uint32_t> v;
+      v.reserve(start);
+      for (uint32_t i = 0; i < N; ++i) v.push_back((uint32_t)input[i]);
+      keep(v.data());
+    });
+  }
+
+  // The same elements, in slices of 64.
+  bench("append_n/per_element", N, [&] {
+    DYN_ARR_OF(uint64_t) a;
+    DYN_ARR_RESET(a, 0u);
+    for (uint32_t i = 0; i < N; i += 64u) {
+      for (uint32_t j = i; j < i + 64u; ++j) DYN_ARR_APPEND(a, input[j]);
+    }
+    keep(a.data);
+    DYN_ARR_DESTROY(a);
+  });
+  bench("append_n/bulk", N, [&] {
+    DYN_ARR_OF(uint64_t) a;
+    DYN_ARR_RESET(a, 0u);
+    for (uint32_t i = 0; i < N; i += 64u) DYN_ARR_APPEND_N(a, &input[i], 64u);
+    keep(a.data);
+    DYN_ARR_DESTROY(a);
+  });
+
+#if defined(MAP_ANONYMOUS)
+  bench("append/dyn_arr_vm", N, [&] {
+    DYN_ARR_VM_OF(uint32_t) a;
+    DYN_ARR_VM_RESET(a, N, 0u);
+    for (uint32_t i = 0; i < N; ++i) DYN_ARR_VM_APPEND(a, (uint32_t)input[i]);
+    keep(a.data);
+    DYN_ARR_VM_DESTROY(a);
+  });
+#endif
+
+  // Non-trivial elements: DynArray and std::vector both move them on growth.
+  std::vector<std::string> strings;
+  for (uint32_t i = 0; i < N / 16u; ++i) strings.push_back("a string too long to be stored inline " + std::to_string(input[i]));
+  bench("append/DynArray/string", N / 16u, [&] {
+    DynArray<std::string> a;
+    for (const std::string &s : strings) a.push_back(s);
+    keep(a.data);
+  });
+  bench("append/std_vector/string", N / 16u, [&] {
+    std::vector<std::string> v;
+    for (const std::string &s : strings) v.push_back(s);
+    keep(v.data());
+  });
+}
+
+// Growing from empty, every append timed: the plain array copies everything
+// on the appends that grow it, the incremental one a few elements each time.
+static void bench_append_latency() {
+  const uint32_t COUNT = 1u << 18;
+  bench_latency("append_latency/dyn_arr", [](std::vector<double> &samples) {
+    DYN_ARR_OF(uint64_t) a;
+    DYN_ARR_RESET(a, 0u);
+    for (uint64_t i = 0; i < COUNT; ++i) {
+      double start = now_ns();
+      DYN_ARR_APPEND(a, i);
+      samples.push_back(now_ns() - start);
+    }
+    keep(a.data);
+    DYN_ARR_DESTROY(a);
+  });
+  bench_latency("append_latency/dyn_arr_incr", [](std::vector<double> &samples) {
+    DYN_ARR_INCR_OF(uint64_t) a;
+    DYN_ARR_INCR_RESET(a, 0u);
+    for (uint64_t i = 0; i < COUNT; ++i) {
+      double start = now_ns();
+      DYN_ARR_INCR_APPEND(a, i);
+      samples.push_back(now_ns() - start);
+    }
+    keep(a.data);
+    DYN_ARR_INCR_DESTROY(a);
+  });
+}
+
+static void bench_iterate() {
+  std::vector<uint64_t> input = random_values(N, 2);
+  DYN_ARR_OF(uint32_t) a;
+  DYN_ARR_RESET(a, N);
+  for (uint64_t value : input) DYN_ARR_APPEND(a, (uint32_t)value);
+  std::vector<uint32_t> v(a.data, a.endptr);
+
+  bench("foreach/dyn_arr", N, [&] {
+    uint64_t sum = 0;
+    DYN_ARR_FOREACH(a, i) sum += DYN_ARR_AT(a, i);
+    keep(sum);
+  });
+  bench("foreach/std_vector", N, [&] {
+    uint64_t sum = 0;
+    for (uint32_t value : v) sum += value;
+    keep(sum);
+  });
+  DYN_ARR_DESTROY(a);
+}
+
+// Using an array as a stack, or clearing and refilling it, reuses its
+// capacity; "fresh" allocates a new one every round instead.
+static void bench_reuse() {
+  const uint32_t ROUNDS = 256, DEPTH = 4096;
+  DYN_ARR_OF(uint32_t) a;
+  DYN_ARR_RESET(a, 0u);
+  std::vector<uint32_t> v;
+
+  bench("reuse/pop/dyn_arr", 2.0 * ROUNDS * DEPTH, [&] {
+    uint64_t sum = 0;
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+      for (uint32_t i = 0; i < DEPTH; ++i) DYN_ARR_APPEND(a, i);
+      while (!DYN_ARR_EMPTY(a)) {
+        sum += *DYN_ARR_BACKPTR(a);
+        DYN_ARR_POP(a);
+      }
+    }
+    keep(sum);
+  });
+  bench("reuse/pop/std_vector", 2.0 * ROUNDS * DEPTH, [&] {
+    uint64_t sum = 0;
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+      for (uint32_t i = 0; i < DEPTH; ++i) v.push_back(i);
+      while (!v.empty()) {
+        sum += v.back();
+        v.pop_back();
+      }
+    }
+    keep(sum);
+  });
+  bench("reuse/clear/dyn_arr", (double)ROUNDS * DEPTH, [&] {
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+      DYN_ARR_CLEAR(a);
+      for (uint32_t i = 0; i < DEPTH; ++i) DYN_ARR_APPEND(a, i);
+      keep(a.data);
+    }
+  });
+  bench("reuse/clear/std_vector", (double)ROUNDS * DEPTH, [&] {
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+      v.clear();
+      for (uint32_t i = 0; i < DEPTH; ++i) v.push_back(i);
+      keep(v.data());
+    }
+  });
+  bench("reuse/fresh/dyn_arr", (double)ROUNDS * DEPTH, [&] {
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+      DYN_ARR_OF(uint32_t) fresh;
+      DYN_ARR_RESET(fresh, 0u);
+      for (uint32_t i = 0; i < DEPTH; ++i) DYN_ARR_APPEND(fresh, i);
+      keep(fresh.data);
+      DYN_ARR_DESTROY(fresh);
+    }
+  });
+  DYN_ARR_DESTROY(a);
+}
+
+// Many short-lived arrays: per array, filled, summed and destroyed.
+static void bench_short_lived() {
+  const uint32_t ARRAYS = 1u << 16;
+  std::vector<uint64_t> sizes = random_values(ARRAYS, 3);
+  for (uint64_t &size : sizes) size = 1u + size % 256u;
+
+  bench("short_lived/small16/12_elements", ARRAYS, [&] {
+    for (uint32_t n = 0; n < ARRAYS; ++n) {
+      DYN_ARR_SMALL_OF(uint32_t, 16) a;
+      DYN_ARR_SMALL_RESET(a);
+      for (uint32_t i = 0; i < 12u; ++i) DYN_ARR_APPEND(a, i + n);
+      keep(a.data);
+      DYN_ARR_DESTROY(a);
+    }
+  });
+  bench("short_lived/malloc/12_elements", ARRAYS, [&] {
+    for (uint32_t n = 0; n < ARRAYS; ++n) {
+      DYN_ARR_OF(uint32_t) a;
+      DYN_ARR_RESET(a, 0u);
+      for (uint32_t i = 0; i < 12u; ++i) DYN_ARR_APPEND(a, i + n);
+      keep(a.data);
+      DYN_ARR_DESTROY(a);
+    }
+  });
+
+  dyn_arr_arena arena;
+  dyn_arr_arena_init(&arena, 1u << 20);
+  dyn_arr_pool pool;
+  dyn_arr_pool_init(&pool);
+  struct {
+    const char *name;
+    dyn_arr_allocator *allocator;
+  } allocators[] = {{"malloc", NULL}, {"arena", &arena.allocator}, {"pool", &pool.allocator}};
+  for (const auto &with : allocators) {
+    bench(std::string("short_lived/") + with.name + "/1-256_elements", ARRAYS, [&] {
+      for (uint32_t n = 0; n < ARRAYS; ++n) {
+        DYN_ARR_OF(uint32_t) a;
+        DYN_ARR_RESET_WITH(a, 0u, with.allocator);
+        for (uint32_t i = 0; i < sizes[n]; ++i) DYN_ARR_APPEND(a, i);
+        keep(a.data);
+        DYN_ARR_DESTROY(a);
+      }
+      dyn_arr_arena_reset(&arena);
+    });
+  }
+  dyn_arr_pool_destroy(&pool);
+  dyn_arr_arena_destroy(&arena);
+}
+
+struct bench_point {
+  uint32_t x, y, z, w;
+};
+
+DYN_SOA_OF(bench_points, (uint32_t, x), (uint32_t, y), (uint32_t, z), (uint32_t, w))
+
+static void bench_soa() {
+  std::vector<uint64_t> input = random_values(N, 4);
+  bench_points soa = {};
+  DYN_ARR_OF(bench_point) aos;
+  DYN_ARR_RESET(aos, 0u);
+  for (uint64_t value : input) {
+    uint32_t x = (uint32_t)value, y = (uint32_t)(value >> 32);
+    bench_points_append(&soa, x, y, x ^ y, x + y);
+    bench_point p = {x, y, x ^ y, x + y};
+    DYN_ARR_APPEND(aos, p);
+  }
+  bench("sum_one_field/soa", N, [&] {
+    uint64_t sum = 0;
+    DYN_SOA_FOREACH(soa, i) sum += soa.x[i];
+    keep(sum);
+  });
+  bench("sum_one_field/aos", N, [&] {
+    uint64_t sum = 0;
+    DYN_ARR_FOREACH(aos, i) sum += aos.data[i].x;
+    keep(sum);
+  });
+  bench_points_destroy(&soa);
+  DYN_ARR_DESTROY(aos);
+}
+
+// N appends shared between the threads, starting them included.
+static void bench_concurrent() {
+  for (unsigned threads = 1; threads <= 64; threads *= 2) {
+    std::string suffix = "/threads=" + std::to_string(threads);
+    bench("concurrent_append/dyn_arr_conc" + suffix, N, [&] {
+      DYN_ARR_CONC_OF(uint64_t) a = {};
+      std::vector<std::thread> workers;
+      for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&a, t, threads] {
+          for (uint64_t i = t; i < N; i += threads) DYN_ARR_CONC_APPEND(a, i);
+        });
+      }
+      for (std::thread &worker : workers) worker.join();
+      keep(a.segments);
+      DYN_ARR_CONC_DESTROY(a);
+    });
+    bench("concurrent_append/mutex" + suffix, N, [&] {
+      DYN_ARR_OF(uint64_t) a;
+      DYN_ARR_RESET(a, 0u);
+      std::mutex mutex;
+      std::vector<std::thread> workers;
+      for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&a, &mutex, t, threads] {
+          for (uint64_t i = t; i < N; i += threads) {
+            std::lock_guard<std::mutex> lock(mutex);
+            DYN_ARR_APPEND(a, i);
+          }
+        });
+      }
+      for (std::thread &worker : workers) worker.join();
+      keep(a.data);
+      DYN_ARR_DESTROY(a);
+    });
+  }
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void sum_range(void *ctx, size_t begin, size_t end, void *partial) {
+  const uint32_t *data = (const uint32_t *)ctx;
+  uint64_t sum = 0;
+  for (size_t i = begin; i < end; ++i) sum += data[i];
+  *(uint64_t *)partial += sum;
+}
+
+static void add_sums(void *ctx, void *into, const void *from) {
+  (void)ctx;
+  *(uint64_t *)into += *(const uint64_t *)from;
+}
+
+// Across pool sizes up to DYN_ARR_MAX_THREADS and a few array sizes, with the
+// serial versions for comparison. One thread runs everything inline, so the
+// work stealing only shows from two up.
+static void bench_parallel() {
+  const uint32_t SIZES[] = {1u << 16, N, 1u << 22};
+  for (uint32_t n : SIZES) {
+    std::string size = "/n=" + std::to_string(n);
+    std::vector<uint64_t> input = random_values(n, 5);
+    DYN_ARR_OF(uint32_t) a;
+    DYN_ARR_RESET(a, n);
+    for (uint64_t value : input) DYN_ARR_APPEND(a, (uint32_t)value);
+    auto unsorted = [&] {
+      for (uint32_t i = 0; i < n; ++i) a.data[i] = (uint32_t)input[i];
+    };
+
+    for (unsigned threads = 1; threads <= DYN_ARR_MAX_THREADS; threads *= 2) {
+      dyn_arr_thread_pool pool;
+      dyn_arr_thread_pool_init(&pool, threads);
+      std::string suffix = size + "/threads=" + std::to_string(pool.thread_count);
+
+      bench("parallel_reduce/sum" + suffix, n, [&] {
+        uint64_t sum = 0;
+        DYN_ARR_PARALLEL_REDUCE(&pool, a, 0, &sum, sum_range, add_sums, a.data);
+        keep(sum);
+      });
+      bench("sort/parallel_radix" + suffix, n, unsorted, [&] { DYN_ARR_PARALLEL_RADIX_SORT(&pool, a); });
+      bench("sort/parallel_merge" + suffix, n, unsorted, [&] { DYN_ARR_PARALLEL_SORT(&pool, a, compare_u32); });
+      dyn_arr_thread_pool_destroy(&pool);
+    }
+    bench("sort/dyn_arr_sort" + size, n, unsorted, [&] { DYN_ARR_SORT(a, compare_u32); });
+    bench("sort/std_sort" + size, n, unsorted, [&] { std::sort(a.data, a.endptr); });
+
+    DYN_ARR_DESTROY(a);
+  }
+}
+
+DYN_FLAT_MAP_OF(bench_flat_map, uint64_t, uint64_t, DYN_MAP_LESS)
+DYN_HASH_MAP_OF(bench_hash_map, uint64_t, uint64_t, dyn_map_hash_u64, DYN_MAP_EQUAL)
+
+// Keys present are even and keys missing odd, looked up in random order.
+static void bench_maps() {
+  const uint32_t KEYS = 1u << 16;
+  std::vector<uint64_t> keys = random_values(KEYS, 6), misses = random_values(KEYS, 7);
+  for (uint64_t &key : keys) key &= ~(uint64_t)1;
+  for (uint64_t &key : misses) key |= 1u;
+  std::vector<bench_flat_map_entry> batch;
+  for (uint64_t key : keys) batch.push_back({key, key});
+
+  bench_flat_map flat = {};
+  bench_hash_map hash = {};
+  std::unordered_map<uint64_t, uint64_t> std_map;
+  auto lookups = [&](const char *name, const std::vector<uint64_t> &find) {
+    std::string suffix = std::string("/") + name;
+    bench("map/flat_map" + suffix, KEYS, [&] {
+      size_t found = 0;
+      for (uint64_t key : find) found += bench_flat_map_find(&flat, key) != NULL;
+      keep(found);
+    });
+    bench("map/hash_map" + suffix, KEYS, [&] {
+      size_t found = 0;
+      for (uint64_t key : find) found += bench_hash_map_find(&hash, key) != NULL;
+      keep(found);
+    });
+    bench("map/std_unordered_map" + suffix, KEYS, [&] {
+      size_t found = 0;
+      for (uint64_t key : find) found += std_map.find(key) != std_map.end();
+      keep(found);
+    });
+  };
+
+  bench("map/flat_map/insert_batch", KEYS, [&] {
+    bench_flat_map_destroy(&flat);
+    bench_flat_map_insert_batch(&flat, batch.data(), batch.size());
+  });
+  bench("map/hash_map/insert", KEYS, [&] {
+    bench_hash_map_destroy(&hash);
+    for (uint64_t key : keys) bench_hash_map_insert(&hash, key, key);
+  });
+  bench("map/std_unordered_map/insert", KEYS, [&] {
+    std_map = std::unordered_map<uint64_t, uint64_t>();
+    for (uint64_t key : keys) std_map[key] = key;
+  });
+  // Skipped with a filter that left the maps empty.
+  if (DYN_ARR_SIZE(flat.entries) == KEYS && hash.size == KEYS && std_map.size() == KEYS) {
+    std::vector<uint64_t> hits = keys;
+    std::shuffle(hits.begin(), hits.end(), std::mt19937_64(seed));
+    lookups("hit", hits);
+    lookups("miss", misses);
+  }
+  bench_flat_map_destroy(&flat);
+  bench_hash_map_destroy(&hash);
+}
+
+// Getting a saved array back: mapping it against reading it in.
+static void bench_persist() {
+#if defined(__unix__) || defined(__APPLE__)
+  std::vector<uint64_t> input = random_values(4u * N, 8);
+  DYN_ARR_OF(uint64_t) a;
+  DYN_ARR_RESET(a, 4u * N);
+  DYN_ARR_APPEND_N(a, input.data(), 4u * N);
+  const char *dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+  std::string path = std::string(dir) + "/dynamic_array_bench.bin";
+
+  if (DYN_ARR_SAVE(a, path.c_str()) != DYN_ARR_FILE_OK) {
+    perror(path.c_str());
+    DYN_ARR_DESTROY(a);
+    return;
+  }
+  bench("persist/save/32MB", 1, [&] {
+    if (DYN_ARR_SAVE(a, path.c_str()) != DYN_ARR_FILE_OK) abort();
+  });
+  DYN_ARR_DESTROY(a);
+
+  for (int mode : {(int)DYN_ARR_MAP_READ_ONLY, DYN_ARR_MAP_READ_ONLY | DYN_ARR_MAP_VERIFY}) {
+    bench(mode & DYN_ARR_MAP_VERIFY ? "persist/map_verified/32MB" : "persist/map/32MB", 1, [&] {
+      DYN_ARR_OF(uint64_t) mapped;
+      int status;
+      DYN_ARR_MAP(mapped, path.c_str(), mode, status);
+      if (status != DYN_ARR_FILE_OK) abort();
+      keep(mapped.data);
+      DYN_ARR_DESTROY(mapped);
+    });
+  }
+  bench("persist/read/32MB", 1, [&] {
+    FILE *in = fopen(path.c_str(), "rb");
+    if (in == NULL) abort();
+    DYN_ARR_OF(uint64_t) read;
+    DYN_ARR_RESET(read, 0u);
+    DYN_ARR_RESIZE(read, 4u * N);
+    fseek(in, DYN_ARR_FILE_HEADER_SIZE, SEEK_SET);
+    if (fread(read.data, sizeof(read.data[0]), 4u * N, in) != 4u * N) abort();
+    fclose(in);
+    keep(read.data);
+    DYN_ARR_DESTROY(read);
+  });
+  remove(path.c_str());
+#endif
+}
+
+int main(int argc, char **argv) {
+  const char *json = NULL;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--runs" && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+      if (runs < 1) runs = 1;
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 0);
+    } else if (arg == "--json" && i + 1 < argc) {
+      json = argv[++i];
+    } else if (arg.compare(0, 2, "--") == 0) {
+      fprintf(stderr, "usage: %s [--runs N] [--seed S] [--json results.json] [filter...]\n", argv[0]);
+      return 1;
+    } else {
+      filters.push_back(arg);
+    }
+  }
+
+  printf("%-44s %10s %10s %10s %10s %10s %10s\n", "benchmark", "min", "p50", "p90", "p99", "p99.9", "max");
+  bench_append();
+  bench_append_latency();
+  bench_iterate();
+  bench_reuse();
+  bench_short_lived();
+  bench_soa();
+  bench_concurrent();
+  bench_parallel();
+  bench_maps();
+  bench_persist();
+  if (json != NULL) write_json(json);
+  return 0;
+}
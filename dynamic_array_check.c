@@ -0,0 +1,839 @@
+// Checks for dynamic_array.h and the headers built on it. Asserts must be
+// on: build without -DNDEBUG.
+// Needs -pthread; add -fsanitize=thread to check the concurrent array and
+// the thread pool for races. Build it again with -DDYN_ARR_INSTRUMENT=1 to
+// check the instrumentation.
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS and fork() in strict ISO modes
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "dynamic_array.h"
+#include "dynamic_array_map.h"
+#include "dynamic_array_parallel.h"
+
+// Counts what goes through it, and passes it on to backing (NULL for
+// malloc, realloc and free).
+typedef struct counting_allocator {
+  dyn_arr_allocator allocator; // point arrays at this
+  dyn_arr_allocator *backing;
+  int allocs, resizes, releases;
+  int64_t bytes; // outstanding, going by the sizes passed in
+} counting_allocator;
+
+static void *counting_resize(dyn_arr_allocator *self, void *ptr, size_t old_size, size_t new_size) {
+  counting_allocator *counts = (counting_allocator *)self;
+  if (ptr == NULL) {
+    counts->allocs++;
+  } else {
+    counts->resizes++;
+  }
+  counts->bytes += (int64_t)new_size - (int64_t)old_size;
+  return dyn_arr__resize(counts->backing, ptr, old_size, new_size);
+}
+
+static void counting_release(dyn_arr_allocator *self, void *ptr, size_t size) {
+  counting_allocator *counts = (counting_allocator *)self;
+  counts->releases++;
+  counts->bytes -= (int64_t)size;
+  dyn_arr__release(counts->backing, ptr, size);
+}
+
+static counting_allocator counting_init(dyn_arr_allocator *backing) {
+  counting_allocator counts = {{counting_resize, counting_release}, backing, 0, 0, 0, 0};
+  return counts;
+}
+
+// A DYN_ARR_SMALL_OF array never allocates while it fits inline, and
+// allocates once when it spills.
+static void check_small(void) {
+  counting_allocator counts = counting_init(NULL);
+  DYN_ARR_SMALL_OF(int, 16) a;
+  DYN_ARR_SMALL_RESET(a);
+  // Anything it allocates from now on goes through counts.
+  a.allocator = &counts.allocator;
+
+  for (int i = 0; i < 16; i++) DYN_ARR_APPEND(a, i);
+  DYN_ARR_POP(a);
+  int more[] = {15};
+  DYN_ARR_APPEND_N(a, more, 1);
+  DYN_ARR_RESERVE(a, 16);
+  DYN_ARR_SHRINK_TO_FIT(a);
+  assert(a.data == a.inline_data);
+  assert(DYN_ARR_SIZE(a) == 16);
+  assert(counts.allocs == 0 && counts.resizes == 0 && counts.releases == 0);
+
+  DYN_ARR_APPEND(a, 16);
+  assert(a.data != a.inline_data);
+  assert(!(a.flags & DYN_ARR_FLAG_INLINE));
+  assert(counts.allocs == 1 && counts.resizes == 0);
+  DYN_ARR_FOREACH(a, i) assert(DYN_ARR_AT(a, i) == (int)i);
+
+  DYN_ARR_DESTROY(a);
+  assert(counts.releases == 1);
+
+  // Destroying it while inline gives nothing back.
+  DYN_ARR_SMALL_RESET(a);
+  a.allocator = &counts.allocator;
+  DYN_ARR_APPEND(a, 1);
+  DYN_ARR_DESTROY(a);
+  assert(counts.allocs == 1 && counts.releases == 1);
+  printf("small: ok\n");
+}
+
+// Popping while elements are still pending leaves the back in the old
+// buffer, where DYN_ARR_INCR_BACKPTR finds it.
+static void check_incr(void) {
+  DYN_ARR_INCR_OF(int) a;
+  DYN_ARR_INCR_RESET(a, 8u);
+  for (int i = 0; i < 9; i++) DYN_ARR_INCR_APPEND(a, i);
+  assert(a.pending > 0);
+  for (int i = 0; i < 5; i++) DYN_ARR_INCR_POP(a);
+  assert(DYN_ARR_SIZE(a) == 4 && a.pending == 4);
+  assert(*DYN_ARR_INCR_BACKPTR(a) == 3);
+  *DYN_ARR_INCR_BACKPTR(a) = 30;
+  assert(DYN_ARR_INCR_AT(a, 3) == 30);
+
+  DYN_ARR_INCR_FINISH(a);
+  assert(a.pending == 0 && a.old == NULL);
+  assert(*DYN_ARR_INCR_BACKPTR(a) == 30 && *DYN_ARR_BACKPTR(a) == 30);
+  DYN_ARR_FOREACH(a, i) {
+    assert(DYN_ARR_AT(a, i) == (i == 3 ? 30 : (int)i));
+  }
+  DYN_ARR_INCR_DESTROY(a);
+
+  // Both buffers come from the allocator and go back to it, at the sizes
+  // they were allocated with, whether migration finished or not.
+  counting_allocator counts = counting_init(NULL);
+  for (int finish = 0; finish < 2; finish++) {
+    DYN_ARR_INCR_RESET_WITH(a, 8u, &counts.allocator);
+    for (int i = 0; i < 100; i++) DYN_ARR_INCR_APPEND(a, i);
+    if (finish) DYN_ARR_INCR_FINISH(a);
+    DYN_ARR_FOREACH(a, i) assert(DYN_ARR_INCR_AT(a, i) == (int)i);
+    DYN_ARR_INCR_DESTROY(a);
+    assert(counts.allocs == counts.releases && counts.bytes == 0);
+  }
+  assert(counts.resizes == 0);
+
+  // Or from an arena, which DESTROY leaves alone.
+  dyn_arr_arena arena;
+  dyn_arr_arena_init(&arena, 4096);
+  DYN_ARR_INCR_RESET_WITH(a, 8u, &arena.allocator);
+  for (int i = 0; i < 100; i++) DYN_ARR_INCR_APPEND(a, i);
+  DYN_ARR_FOREACH(a, i) assert(DYN_ARR_INCR_AT(a, i) == (int)i);
+  char *cur = arena.cur;
+  DYN_ARR_INCR_DESTROY(a);
+  assert(arena.cur == cur);
+  dyn_arr_arena_destroy(&arena);
+  printf("incr: ok\n");
+}
+
+enum { CONC_PRODUCERS = 4, CONC_PER_PRODUCER = 20000 };
+
+// Each element is producer << 32 | sequence number.
+static DYN_ARR_CONC_OF(uint64_t) conc;
+static int conc_done;
+
+static void *conc_produce(void *arg) {
+  uint64_t producer = (uint64_t)(uintptr_t)arg;
+  for (uint64_t i = 0; i < CONC_PER_PRODUCER; i++) {
+    DYN_ARR_CONC_APPEND(conc, producer << 32 | i);
+  }
+  return NULL;
+}
+
+// Walks the published prefix: every element in it must be written, and each
+// producer's elements must be in the order it appended them.
+static uint64_t conc_walk(void) {
+  uint64_t next[CONC_PRODUCERS] = {0};
+  uint64_t count = 0;
+  DYN_ARR_CONC_FOREACH(conc, i) {
+    uint64_t value = DYN_ARR_CONC_AT(conc, i);
+    uint64_t producer = value >> 32;
+    assert(producer < CONC_PRODUCERS);
+    assert((value & 0xffffffffu) == next[producer]);
+    next[producer]++;
+    count++;
+  }
+  return count;
+}
+
+static void *conc_read(void *arg) {
+  (void)arg;
+  uint64_t seen = 0;
+  while (!__atomic_load_n(&conc_done, __ATOMIC_ACQUIRE)) {
+    uint64_t count = conc_walk();
+    // The published prefix never shrinks.
+    assert(count >= seen);
+    seen = count;
+  }
+  return NULL;
+}
+
+// Producers append at once while a reader walks what's published so far.
+static void check_conc(void) {
+  pthread_t producers[CONC_PRODUCERS], reader;
+  pthread_create(&reader, NULL, conc_read, NULL);
+  for (uintptr_t p = 0; p < CONC_PRODUCERS; p++) {
+    pthread_create(&producers[p], NULL, conc_produce, (void *)p);
+  }
+  for (int p = 0; p < CONC_PRODUCERS; p++) pthread_join(producers[p], NULL);
+  __atomic_store_n(&conc_done, 1, __ATOMIC_RELEASE);
+  pthread_join(reader, NULL);
+
+  assert(DYN_ARR_CONC_PUBLISHED(conc) == CONC_PRODUCERS * CONC_PER_PRODUCER);
+  assert(conc_walk() == CONC_PRODUCERS * CONC_PER_PRODUCER);
+  DYN_ARR_CONC_DESTROY(conc);
+  printf("conc: ok\n");
+}
+
+static size_t arena_blocks(const dyn_arr_arena *arena) {
+  size_t count = 0;
+  for (const dyn_arr_arena_block *block = arena->blocks; block != NULL; block = block->next) count++;
+  return count;
+}
+
+// The arena's newest allocation grows in place, DESTROY gives nothing back,
+// and a reset frees every block but the newest.
+static void check_arena(void) {
+  dyn_arr_arena arena;
+  dyn_arr_arena_init(&arena, 4096);
+  counting_allocator counts = counting_init(&arena.allocator);
+
+  DYN_ARR_OF(int) a;
+  DYN_ARR_RESET_WITH(a, 8u, &counts.allocator);
+  int *first = a.data;
+  for (int i = 0; i < 512; i++) DYN_ARR_APPEND(a, i);
+  assert(a.data == first);
+  assert(counts.allocs == 1 && counts.resizes > 0);
+  assert(arena_blocks(&arena) == 1);
+
+  // Once something else is allocated, growing a has to copy.
+  DYN_ARR_OF(int) b;
+  DYN_ARR_RESET_WITH(b, 8u, &arena.allocator);
+  uint32_t capacity = a.capacity;
+  for (int i = (int)DYN_ARR_SIZE(a); a.capacity == capacity; i++) DYN_ARR_APPEND(a, i);
+  assert(a.data != first);
+  DYN_ARR_FOREACH(a, i) assert(DYN_ARR_AT(a, i) == (int)i);
+  assert(arena_blocks(&arena) == 2);
+
+  char *cur = arena.cur;
+  DYN_ARR_DESTROY(b);
+  DYN_ARR_DESTROY(a);
+  assert(arena.cur == cur && arena_blocks(&arena) == 2);
+  assert(counts.releases == 1);
+
+  dyn_arr_arena_reset(&arena);
+  assert(arena_blocks(&arena) == 1);
+  char *start = (char *)arena.blocks + DYN_ARR__ALIGN_UP(sizeof(dyn_arr_arena_block));
+  assert(arena.cur == start);
+  DYN_ARR_RESET_WITH(a, 8u, &arena.allocator);
+  assert((char *)a.data == start);
+
+  dyn_arr_arena_destroy(&arena);
+  assert(arena.blocks == NULL);
+  printf("arena: ok\n");
+}
+
+// Freed blocks go back on their size class's free list, and the next
+// allocation in that class reuses them.
+static void check_pool(void) {
+  dyn_arr_pool pool;
+  dyn_arr_pool_init(&pool);
+  counting_allocator counts = counting_init(&pool.allocator);
+
+  DYN_ARR_OF(int) a;
+  DYN_ARR_RESET_WITH(a, 8u, &counts.allocator); // 32 bytes
+  int *block = a.data;
+  DYN_ARR_DESTROY(a);
+  DYN_ARR_RESET_WITH(a, 7u, &counts.allocator); // the same class
+  assert(a.data == block);
+
+  // Growing into the next class frees the old block for the next array.
+  for (int i = 0; i < 9; i++) DYN_ARR_APPEND(a, i);
+  assert(a.data != block && a.capacity == 14);
+  DYN_ARR_OF(int) b;
+  DYN_ARR_RESET_WITH(b, 5u, &counts.allocator);
+  assert(b.data == block);
+
+  // Within a class, growing keeps the block.
+  int *grown = a.data;
+  DYN_ARR_RESERVE(a, 16u);
+  DYN_ARR_SHRINK_TO_FIT(a);
+  assert(a.data == grown && a.capacity == 9);
+  DYN_ARR_FOREACH(a, i) assert(DYN_ARR_AT(a, i) == (int)i);
+
+  // Bigger than the largest class goes to malloc.
+  DYN_ARR_OF(char) big;
+  DYN_ARR_RESET_WITH(big, 1u << 20, &counts.allocator);
+  memset(big.data, 1, 1u << 20);
+  DYN_ARR_DESTROY(big);
+
+  DYN_ARR_DESTROY(a);
+  DYN_ARR_DESTROY(b);
+  assert(counts.allocs == 4 && counts.releases == 4);
+  dyn_arr_pool_destroy(&pool);
+  printf("pool: ok\n");
+}
+
+DYN_SOA_OF(check_rows, (uint8_t, tag), (double, weight), (uint64_t, id))
+
+static void check_rows_in_step(const check_rows *rows, uint32_t count) {
+  assert(rows->size == count && rows->capacity >= count);
+  assert((uintptr_t)rows->tag % DYN_SOA_ALIGN == 0);
+  assert((uintptr_t)rows->weight % DYN_SOA_ALIGN == 0);
+  assert((uintptr_t)rows->id % DYN_SOA_ALIGN == 0);
+  DYN_SOA_FOREACH(*rows, i) {
+    assert(rows->tag[i] == (uint8_t)i);
+    assert(rows->weight[i] == (double)i / 2);
+    assert(rows->id[i] == i * 1000u);
+  }
+}
+
+// Every column keeps its rows through growth, and they stay in step.
+static void check_soa(void) {
+  check_rows rows = {0};
+  uint32_t capacity = 0, grew = 0;
+  for (uint32_t i = 0; i < 1000; i++) {
+    check_rows_append(&rows, (uint8_t)i, (double)i / 2, i * 1000u);
+    if (rows.capacity != capacity) {
+      capacity = rows.capacity;
+      grew++;
+      check_rows_in_step(&rows, i + 1);
+    }
+  }
+  assert(grew > 1);
+  check_rows_in_step(&rows, 1000);
+
+  check_rows_reserve(&rows, 5000);
+  assert(rows.capacity == 5000);
+  check_rows_in_step(&rows, 1000);
+  check_rows_resize(&rows, 10);
+  check_rows_in_step(&rows, 10);
+  check_rows_resize(&rows, 6000);
+  assert(rows.size == 6000 && rows.capacity >= 6000);
+  rows.size = 10;
+  check_rows_in_step(&rows, 10);
+
+  check_rows_destroy(&rows);
+  assert(rows.block == NULL && rows.size == 0 && rows.capacity == 0);
+  printf("soa: ok\n");
+}
+
+static uint64_t check_random(uint64_t *state) {
+  uint64_t x = (*state += 0x9e3779b97f4a7c15ull);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+typedef struct steal_job {
+  pthread_t caller;
+  int runs[64];
+  int stolen; // of the caller's share
+} steal_job;
+
+// The caller's share is slow, so the other threads run out first and
+// steal from it.
+static void steal_body(void *ctx, size_t begin, size_t end) {
+  steal_job *job = (steal_job *)ctx;
+  for (size_t i = begin; i < end; i++) {
+    __atomic_fetch_add(&job->runs[i], 1, __ATOMIC_RELAXED);
+    if (i < 16) {
+      if (!pthread_equal(pthread_self(), job->caller)) {
+        __atomic_fetch_add(&job->stolen, 1, __ATOMIC_RELAXED);
+      }
+      usleep(2000);
+    }
+  }
+}
+
+static void sum_doubles(void *ctx, size_t begin, size_t end, void *partial) {
+  const double *values = (const double *)ctx;
+  double sum = 0;
+  for (size_t i = begin; i < end; i++) sum += values[i];
+  *(double *)partial += sum;
+}
+
+static void add_doubles(void *ctx, void *into, const void *from) {
+  (void)ctx;
+  *(double *)into += *(const double *)from;
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+typedef struct sort_item {
+  uint32_t key;
+  uint32_t index; // where it started, to check stability
+} sort_item;
+
+static int compare_items(const void *a, const void *b) {
+  return compare_u32(&((const sort_item *)a)->key, &((const sort_item *)b)->key);
+}
+
+// Every algorithm gives the same answer on any number of threads: the
+// serial one's, bit for bit.
+static void check_parallel(void) {
+  const unsigned thread_counts[] = {1, 2, 3, 4, 8};
+  const size_t sizes[] = {0, 1, 2, 5, 1000, 100003};
+  const size_t max_size = 100003;
+  uint64_t state = 42;
+  double *values = (double *)malloc(sizeof(double) * (1u << 20));
+  uint32_t *keys32 = (uint32_t *)malloc(sizeof(uint32_t) * max_size);
+  uint64_t *keys64 = (uint64_t *)malloc(sizeof(uint64_t) * max_size);
+  uint32_t *sorted32 = (uint32_t *)malloc(sizeof(uint32_t) * max_size);
+  uint64_t *sorted64 = (uint64_t *)malloc(sizeof(uint64_t) * max_size);
+  sort_item *items = (sort_item *)malloc(sizeof(sort_item) * max_size);
+  assert(values && keys32 && keys64 && sorted32 && sorted64 && items);
+  // Magnitudes far apart, so summing in another order gives another answer.
+  for (size_t i = 0; i < (1u << 20); i++) {
+    uint64_t r = check_random(&state);
+    values[i] = (double)(r >> 11) * ((r & 1) ? 1e-12 : -1e8) / (double)(1ull << 53);
+  }
+  double serial = 0;
+  dyn_arr_parallel_reduce(NULL, 1u << 20, 0, &serial, sizeof(serial), sum_doubles, add_doubles, values);
+
+  for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+    dyn_arr_thread_pool pool;
+    dyn_arr_thread_pool_init(&pool, thread_counts[t]);
+    assert(pool.thread_count == thread_counts[t]);
+
+    double sum = 0;
+    dyn_arr_parallel_reduce(&pool, 1u << 20, 0, &sum, sizeof(sum), sum_doubles, add_doubles, values);
+    assert(memcmp(&sum, &serial, sizeof(sum)) == 0);
+
+    for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+      size_t count = sizes[n];
+      for (size_t i = 0; i < count; i++) {
+        uint64_t r = check_random(&state);
+        // Half of them share their top bytes, so some passes are skipped.
+        keys64[i] = (i % 2) ? r : (r & 0xffff) | 0xabcd000000000000ull;
+        keys32[i] = (uint32_t)(r >> 32);
+        items[i].key = (uint32_t)(r % 100);
+        items[i].index = (uint32_t)i;
+      }
+      memcpy(sorted32, keys32, sizeof(uint32_t) * count);
+      memcpy(sorted64, keys64, sizeof(uint64_t) * count);
+      qsort(sorted32, count, sizeof(uint32_t), compare_u32);
+      qsort(sorted64, count, sizeof(uint64_t), compare_u64);
+      dyn_arr_parallel_radix_sort(&pool, keys32, count, sizeof(uint32_t));
+      dyn_arr_parallel_radix_sort(&pool, keys64, count, sizeof(uint64_t));
+      assert(memcmp(keys32, sorted32, sizeof(uint32_t) * count) == 0);
+      assert(memcmp(keys64, sorted64, sizeof(uint64_t) * count) == 0);
+
+      dyn_arr_parallel_merge_sort(&pool, items, count, sizeof(sort_item), compare_items);
+      for (size_t i = 1; i < count; i++) {
+        assert(items[i - 1].key < items[i].key
+               || (items[i - 1].key == items[i].key && items[i - 1].index < items[i].index));
+      }
+    }
+
+    if (pool.thread_count == 4) {
+      steal_job job;
+      memset(&job, 0, sizeof(job));
+      job.caller = pthread_self();
+      dyn_arr_parallel_for(&pool, 64, 1, steal_body, &job);
+      for (int i = 0; i < 64; i++) assert(job.runs[i] == 1);
+      assert(job.stolen > 0);
+    }
+    dyn_arr_thread_pool_destroy(&pool);
+  }
+  free(values);
+  free(keys32);
+  free(keys64);
+  free(sorted32);
+  free(sorted64);
+  free(items);
+  printf("parallel: ok\n");
+}
+
+// The low byte of a key picks its slot, so tests can build probe chains
+// where they want them; the rest of the hash is mixed as usual.
+#define check_hash(key) (((key) & 0xffu) | dyn_map_hash_u64(key) << 8)
+
+DYN_HASH_MAP_OF(int_hash_map, uint64_t, uint64_t, check_hash, DYN_MAP_EQUAL)
+DYN_FLAT_MAP_OF(int_flat_map, uint64_t, uint64_t, DYN_MAP_LESS)
+
+// No gaps between a full slot and its key's home, the control bytes match
+// the hashes, and the first group's copy after the end matches.
+static void check_hash_map_invariants(const int_hash_map *m) {
+  size_t capacity = DYN_ARR_SIZE(m->slots), mask = capacity - 1u, size = 0;
+  for (size_t i = 0; i < DYN_MAP_GROUP; i++) {
+    assert(m->ctrl.data[capacity + i] == m->ctrl.data[i]);
+  }
+  DYN_HASH_MAP_FOREACH(*m, i) {
+    uint64_t h = check_hash(m->slots.data[i].key);
+    assert(m->ctrl.data[i] == (uint8_t)(h >> 57));
+    for (size_t j = (size_t)h & mask; j != i; j = (j + 1u) & mask) {
+      assert(m->ctrl.data[j] != DYN_MAP_EMPTY);
+    }
+    size++;
+  }
+  assert(size == m->size);
+}
+
+static void check_hash_map(void) {
+  int_hash_map m;
+  memset(&m, 0, sizeof(m));
+
+  // Three keys at home in slot 14 of 16 fill 14, 15 and wrap to 0; the
+  // keys at home in 15 and 0 go after them.
+  const uint64_t chain[] = {14 | 1u << 8, 14 | 2u << 8, 14 | 3u << 8, 15 | 1u << 8, 0 | 1u << 8, 2 | 1u << 8};
+  const size_t chain_count = sizeof(chain) / sizeof(chain[0]);
+  for (size_t first = 0; first < chain_count; first++) {
+    for (size_t i = 0; i < chain_count; i++) int_hash_map_insert(&m, chain[i], chain[i] * 3);
+    assert(DYN_ARR_SIZE(m.slots) == 16 && m.size == chain_count);
+    assert(m.slots.data[0].key == chain[2] && m.slots.data[1].key == chain[3]);
+    // Erase each in turn, from the front of the chain, its middle or the
+    // wrapped part, and look up everything left every time.
+    for (size_t n = 0; n < chain_count; n++) {
+      size_t gone = (first + n) % chain_count;
+      assert(int_hash_map_erase(&m, chain[gone]) == 1);
+      assert(int_hash_map_erase(&m, chain[gone]) == 0);
+      check_hash_map_invariants(&m);
+      for (size_t k = 0; k < chain_count; k++) {
+        uint64_t *value = int_hash_map_find(&m, chain[k]);
+        int erased = (k + chain_count - first) % chain_count <= n;
+        assert(erased ? value == NULL : value != NULL && *value == chain[k] * 3);
+      }
+    }
+    assert(m.size == 0);
+  }
+
+  // Grows when an insert would take it past 7/8 full.
+  for (uint64_t key = 0; key < 14; key++) int_hash_map_insert(&m, key << 8 | key, key);
+  assert(DYN_ARR_SIZE(m.slots) == 16);
+  int_hash_map_insert(&m, 13 << 8 | 13, 0); // already there
+  assert(DYN_ARR_SIZE(m.slots) == 16 && m.size == 14);
+  int_hash_map_insert(&m, 14 << 8 | 14, 14);
+  assert(DYN_ARR_SIZE(m.slots) == 32 && m.size == 15);
+  check_hash_map_invariants(&m);
+  int_hash_map_reserve(&m, 28);
+  assert(DYN_ARR_SIZE(m.slots) == 32);
+  int_hash_map_reserve(&m, 29);
+  assert(DYN_ARR_SIZE(m.slots) == 64);
+  for (uint64_t key = 0; key < 15; key++) {
+    uint64_t *value = int_hash_map_find(&m, key << 8 | key);
+    assert(value != NULL && *value == (key == 13 ? 0 : key));
+  }
+  int_hash_map_destroy(&m);
+
+  // Random inserts and erases of keys crowded around the ends of the table
+  // at every size it passes through, against a plain array.
+  enum { KEYS = 48 };
+  const uint8_t homes[] = {0, 1, 2, 13, 14, 15, 29, 30, 31, 61, 62, 63};
+  uint64_t keys[KEYS], values[KEYS];
+  int present[KEYS] = {0};
+  for (int k = 0; k < KEYS; k++) keys[k] = (uint64_t)k << 8 | homes[k % sizeof(homes)];
+  uint64_t state = 7;
+  for (int op = 0; op < 20000; op++) {
+    uint64_t r = check_random(&state);
+    int k = (int)(r % KEYS);
+    if ((r >> 32) % 3) {
+      values[k] = r;
+      present[k] = 1;
+      int_hash_map_insert(&m, keys[k], r);
+    } else {
+      assert(int_hash_map_erase(&m, keys[k]) == present[k]);
+      present[k] = 0;
+    }
+    check_hash_map_invariants(&m);
+    for (int j = 0; j < KEYS; j++) {
+      uint64_t *value = int_hash_map_find(&m, keys[j]);
+      assert(present[j] ? value != NULL && *value == values[j] : value == NULL);
+    }
+  }
+  int_hash_map_destroy(&m);
+  printf("hash map: ok\n");
+}
+
+static void check_flat_map(void) {
+  int_flat_map m;
+  memset(&m, 0, sizeof(m));
+  for (uint64_t key = 0; key < 20; key += 2) int_flat_map_insert(&m, key, key);
+
+  // Duplicates in the batch (the later one wins), keys already in the map
+  // (updated in place), and new keys before, between and after them.
+  const int_flat_map_entry batch[] = {
+    {7, 1}, {100, 1}, {4, 1}, {7, 2}, {0, 1}, {1, 1}, {4, 2}, {100, 2}, {19, 1}, {7, 3}, {21, 1},
+  };
+  int_flat_map_insert_batch(&m, batch, sizeof(batch) / sizeof(batch[0]));
+  const int_flat_map_entry expected[] = {
+    {0, 1}, {1, 1}, {2, 2}, {4, 2}, {6, 6}, {7, 3}, {8, 8}, {10, 10}, {12, 12},
+    {14, 14}, {16, 16}, {18, 18}, {19, 1}, {21, 1}, {100, 2},
+  };
+  size_t count = sizeof(expected) / sizeof(expected[0]);
+  assert(DYN_ARR_SIZE(m.entries) == count);
+  for (size_t i = 0; i < count; i++) {
+    assert(m.entries.data[i].key == expected[i].key && m.entries.data[i].value == expected[i].value);
+    assert(*int_flat_map_find(&m, expected[i].key) == expected[i].value);
+  }
+  assert(int_flat_map_find(&m, 3) == NULL && int_flat_map_find(&m, 101) == NULL);
+
+  // Only keys already there: nothing moves.
+  const int_flat_map_entry updates[] = {{21, 5}, {0, 5}, {21, 6}};
+  int_flat_map_insert_batch(&m, updates, 3);
+  assert(DYN_ARR_SIZE(m.entries) == count);
+  assert(*int_flat_map_find(&m, 0) == 5 && *int_flat_map_find(&m, 21) == 6);
+
+  assert(int_flat_map_erase(&m, 7) == 1 && int_flat_map_erase(&m, 7) == 0);
+  assert(DYN_ARR_SIZE(m.entries) == count - 1 && int_flat_map_find(&m, 7) == NULL);
+  DYN_ARR_FOREACH(m.entries, i) {
+    if (i > 0) assert(m.entries.data[i - 1].key < m.entries.data[i].key);
+  }
+  int_flat_map_destroy(&m);
+  printf("flat map: ok\n");
+}
+
+// Overwrites size bytes of path at offset.
+static void patch_file(const char *path, long offset, const void *bytes, size_t size) {
+  FILE *file = fopen(path, "r+b");
+  assert(file != NULL);
+  assert(fseek(file, offset, SEEK_SET) == 0);
+  assert(fwrite(bytes, 1, size, file) == size);
+  fclose(file);
+}
+
+// Saves and maps back, and each kind of bad file is caught and leaves the
+// array alone.
+static void check_save_map(void) {
+  const char *dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+  char path[4096], tmp_path[4096 + 4];
+  snprintf(path, sizeof(path), "%s/dynamic_array_check.bin", dir);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  DYN_ARR_OF(uint32_t) a;
+  DYN_ARR_RESET(a, 0u);
+  for (uint32_t i = 0; i < 1000; i++) DYN_ARR_APPEND(a, i * 7u);
+  assert(DYN_ARR_SAVE(a, path) == DYN_ARR_FILE_OK);
+  assert(access(tmp_path, F_OK) != 0);
+  DYN_ARR_DESTROY(a);
+
+  int status;
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY | DYN_ARR_MAP_VERIFY, status);
+  assert(status == DYN_ARR_FILE_OK);
+  assert(DYN_ARR_SIZE(a) == 1000 && (a.flags & DYN_ARR_FLAG_MAPPED));
+  DYN_ARR_FOREACH(a, i) assert(DYN_ARR_AT(a, i) == i * 7u);
+  // Growing copies it to the heap.
+  DYN_ARR_APPEND(a, 1u);
+  assert(!(a.flags & DYN_ARR_FLAG_MAPPED) && DYN_ARR_SIZE(a) == 1001);
+  assert(DYN_ARR_AT(a, 999) == 999 * 7u);
+  DYN_ARR_DESTROY(a);
+
+  // Copy-on-write changes stay in memory.
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_COPY_ON_WRITE, status);
+  assert(status == DYN_ARR_FILE_OK);
+  DYN_ARR_FOREACH(a, i) DYN_ARR_AT(a, i) = 0;
+  DYN_ARR_DESTROY(a);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY | DYN_ARR_MAP_VERIFY, status);
+  assert(status == DYN_ARR_FILE_OK && DYN_ARR_AT(a, 500) == 500 * 7u);
+  DYN_ARR_DESTROY(a);
+
+  // Failures leave the array as it was.
+  DYN_ARR_RESET(a, 4u);
+  uint32_t *before = a.data;
+  DYN_ARR_OF(uint64_t) wide;
+  DYN_ARR_RESET(wide, 4u);
+  DYN_ARR_MAP(wide, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_ELEM_SIZE && wide.flags == 0);
+  DYN_ARR_DESTROY(wide);
+
+  // A flipped element is only noticed when verifying.
+  uint32_t flipped = 12345;
+  patch_file(path, DYN_ARR_FILE_HEADER_SIZE + 4 * sizeof(uint32_t), &flipped, sizeof(flipped));
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY | DYN_ARR_MAP_VERIFY, status);
+  assert(status == DYN_ARR_FILE_BAD_CHECKSUM && a.data == before);
+  DYN_ARR_OF(uint32_t) unverified;
+  DYN_ARR_MAP(unverified, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_OK && DYN_ARR_AT(unverified, 4) == flipped);
+  DYN_ARR_DESTROY(unverified);
+
+  // One element short, or a byte too many.
+  assert(truncate(path, DYN_ARR_FILE_HEADER_SIZE + 999 * sizeof(uint32_t)) == 0);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_BAD_SIZE && a.data == before);
+  assert(truncate(path, DYN_ARR_FILE_HEADER_SIZE + 1000 * sizeof(uint32_t) + 1) == 0);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_BAD_SIZE && a.data == before);
+
+  // Another version, another magic, or too short for a header.
+  uint32_t version = DYN_ARR_FILE_VERSION + 1u;
+  patch_file(path, offsetof(dyn_arr_file_header, version), &version, sizeof(version));
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_BAD_HEADER && a.data == before);
+  patch_file(path, 0, "NOTARRAY", 8);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_BAD_HEADER && a.data == before);
+  assert(truncate(path, DYN_ARR_FILE_HEADER_SIZE - 1) == 0);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_BAD_HEADER && a.data == before);
+
+  assert(unlink(path) == 0);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY, status);
+  assert(status == DYN_ARR_FILE_IO_ERROR && a.data == before);
+
+  // An empty array round-trips too.
+  DYN_ARR_CLEAR(a);
+  assert(DYN_ARR_SAVE(a, path) == DYN_ARR_FILE_OK);
+  DYN_ARR_DESTROY(a);
+  DYN_ARR_MAP(a, path, DYN_ARR_MAP_READ_ONLY | DYN_ARR_MAP_VERIFY, status);
+  assert(status == DYN_ARR_FILE_OK && DYN_ARR_EMPTY(a));
+  DYN_ARR_DESTROY(a);
+  unlink(path);
+  printf("save and map: ok\n");
+}
+
+// Appends count elements to a VM array reserved for max_count, in a child
+// process, and returns its wait status.
+static int vm_append_in_child(uint64_t max_count, uint64_t count) {
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    // The abort is expected; keep its message out of the output.
+    if (freopen("/dev/null", "w", stderr) == NULL) _exit(2);
+    DYN_ARR_VM_OF(uint64_t) a;
+    DYN_ARR_VM_RESET(a, max_count, 0u);
+    for (uint64_t i = 0; i < count; i++) DYN_ARR_VM_APPEND(a, i);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return status;
+}
+
+// Commits page by page as the array grows, up to the reservation and never
+// past it.
+static void check_vm(void) {
+  const uint32_t flags[] = {0u, DYN_ARR_VM_HUGE_PAGES};
+  for (int f = 0; f < 2; f++) {
+    size_t page = dyn_arr__vm_page(flags[f]);
+    uint64_t max_count = 4 * DYN_ARR_VM_HUGE_PAGE_SIZE / sizeof(uint64_t);
+    DYN_ARR_VM_OF(uint64_t) a;
+    DYN_ARR_VM_RESET(a, max_count, flags[f]);
+    assert(a.reserved == max_count && a.capacity == 0);
+
+    uint64_t commits = 0, capacity = 0;
+    for (uint64_t i = 0; i < max_count; i++) {
+      DYN_ARR_VM_APPEND(a, i);
+      if (a.capacity != capacity) {
+        assert(a.capacity * sizeof(uint64_t) % page == 0);
+        capacity = a.capacity;
+        commits++;
+      }
+    }
+    assert(a.capacity == a.reserved && commits > 1);
+    DYN_ARR_VM_FOREACH(a, i) assert(DYN_ARR_AT(a, i) == i);
+
+    DYN_ARR_VM_RESIZE(a, 1000u);
+    DYN_ARR_VM_SHRINK_TO_FIT(a);
+    assert(a.capacity == (1000u * sizeof(uint64_t) + page - 1u) / page * page / sizeof(uint64_t));
+    assert(DYN_ARR_AT(a, 999) == 999);
+    DYN_ARR_VM_APPEND(a, 1000u);
+    DYN_ARR_VM_RESERVE(a, max_count);
+    assert(a.capacity == a.reserved && DYN_ARR_VM_SIZE(a) == 1001);
+    DYN_ARR_VM_DESTROY(a);
+  }
+
+  // Filling the reservation is fine; going past it aborts even with NDEBUG.
+  int status = vm_append_in_child(1u << 16, 1u << 16);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  status = vm_append_in_child(1u << 16, (1u << 16) + 1u);
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+  printf("vm: ok\n");
+}
+
+#if DYN_ARR_INSTRUMENT
+static const dyn_arr_site_stats *instrument_site(uint32_t line) {
+  for (size_t i = 0; i < DYN_ARR_INSTRUMENT_SITES; i++) {
+    const dyn_arr_site_stats *site = &dyn_arr__my_stats->sites[i];
+    if (site->line == line && strcmp(site->file, __FILE__) == 0) return site;
+  }
+  return NULL;
+}
+
+// Appends 1000 ints to a fresh array and destroys it, all from the line
+// it's used on, which is then one call site.
+#define INSTRUMENT_APPENDS(allocator) { \
+  DYN_ARR_OF(int) a; \
+  DYN_ARR_RESET_WITH(a, 0u, (allocator)); \
+  for (int i = 0; i < 1000; i++) DYN_ARR_APPEND(a, i); \
+  DYN_ARR_DESTROY(a); \
+}
+
+// Pool blocks never grow in place, so every realloc copies; the arena's
+// newest allocation always grows in place.
+static void check_instrument(void) {
+  dyn_arr_pool pool;
+  dyn_arr_pool_init(&pool);
+  dyn_arr_arena arena;
+  dyn_arr_arena_init(&arena, 1u << 16);
+  uint32_t lines[2];
+  lines[0] = __LINE__; INSTRUMENT_APPENDS(&arena.allocator);
+  lines[1] = __LINE__; INSTRUMENT_APPENDS(&pool.allocator);
+
+  for (int moves = 0; moves < 2; moves++) {
+    const dyn_arr_site_stats *site = instrument_site(lines[moves]);
+    assert(site != NULL && site->elem_size == sizeof(int));
+    assert(site->resets == 1 && site->destroys == 1);
+    // Capacity 0 doubles (from the minimum of 8) up to 1024.
+    assert(site->reallocs == 8 && site->peak_capacity == 1024);
+    // Each copy moves what fit before: 8 + 16 + ... + 512 ints.
+    assert(site->bytes_copied == (moves ? sizeof(int) * 1016 : 0));
+    assert(site->slack == sizeof(int) * 24);
+  }
+
+  FILE *report = tmpfile();
+  assert(report != NULL);
+  DYN_ARR_INSTRUMENT_REPORT(report);
+  char text[4096], where[64];
+  rewind(report);
+  size_t size = fread(text, 1, sizeof(text) - 1, report);
+  text[size] = '\0';
+  fclose(report);
+  snprintf(where, sizeof(where), "%s:%u ", __FILE__, (unsigned)lines[1]);
+  assert(strstr(text, where) != NULL);
+
+  dyn_arr_arena_destroy(&arena);
+  dyn_arr_pool_destroy(&pool);
+  printf("instrument: ok\n");
+}
+#else
+#define CHECK_STRING(x) CHECK_STRING_(x)
+#define CHECK_STRING_(x) #x
+
+// Without DYN_ARR_INSTRUMENT, the hooks are empty.
+static void check_instrument(void) {
+  assert(strcmp(CHECK_STRING(DYN_ARR__ON_RESET(a)), "((void)0)") == 0);
+  assert(strcmp(CHECK_STRING(DYN_ARR__ON_REALLOC(a, old_data, size)), "((void)0)") == 0);
+  assert(strcmp(CHECK_STRING(DYN_ARR__ON_DESTROY(a)), "((void)0)") == 0);
+  assert(strcmp(CHECK_STRING(DYN_ARR_INSTRUMENT_REPORT(file)), "((void)0)") == 0);
+  printf("instrument: off\n");
+}
+#endif
+
+int main(void) {
+  check_small();
+  check_incr();
+  check_conc();
+  check_arena();
+  check_pool();
+  check_vm();
+  check_soa();
+  check_parallel();
+  check_hash_map();
+  check_flat_map();
+  check_save_map();
+  check_instrument();
+  return 0;
+}
@@ -0,0 +1,64 @@
+// Checks for the C++ side of dynamic_array.h. Asserts must be on: build
+// without -DNDEBUG.
+#include "dynamic_array.h"
+
+#include <stdio.h>
+#include <string>
+
+// Long enough that std::string keeps them on the heap, so a bad move shows.
+static std::string text(int i) {
+  return "element number " + std::to_string(i) + " of a DynArray<std::string>";
+}
+
+// std::string isn't trivially relocatable, so growing moves each element
+// over and destroys the old one.
+static void check_strings() {
+  DynArray<std::string> a;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 2) {
+      a.push_back(text(i));
+    } else {
+      a.emplace_back(text(i));
+    }
+  }
+  assert(a.size() == 1000);
+  for (int i = 0; i < 1000; i++) assert(a[i] == text(i));
+
+  // Appending an element of the array itself, just as it has to grow.
+  a.shrink_to_fit();
+  assert(a.capacity == a.size());
+  a.push_back(a[0]);
+  assert(a.back() == text(0) && a[0] == text(0));
+
+  DynArray<std::string> copy = a;
+  DynArray<std::string> moved = std::move(a);
+  assert(a.empty() && a.data == nullptr);
+  assert(copy.size() == 1001 && moved.size() == 1001);
+  for (uint32_t i = 0; i < copy.size(); i++) assert(copy[i] == moved[i]);
+
+  moved.resize(10);
+  assert(moved.size() == 10 && moved[9] == text(9));
+  moved.clear();
+  assert(moved.empty());
+  printf("strings: ok\n");
+}
+
+// A DYN_ARR_OF(T) seen as a DynArray<T>, and the other way round.
+static void check_shared() {
+  DYN_ARR_OF(int) c;
+  DYN_ARR_RESET(c, 0u);
+  for (int i = 0; i < 100; i++) DYN_ARR_APPEND(c, i);
+  DynArray<int> &a = DynArray<int>::of(c);
+  for (int i = 100; i < 200; i++) a.push_back(i);
+  assert(DYN_ARR_SIZE(c) == 200 && c.data == a.data);
+  DYN_ARR_FOREACH(c, i) assert(DYN_ARR_AT(c, i) == (int)i);
+  DYN_ARR_DESTROY(c);
+  assert(a.empty());
+  printf("shared: ok\n");
+}
+
+int main() {
+  check_strings();
+  check_shared();
+  return 0;
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "dynamic_array.h"
+
+// Lookup structures kept in DYN_ARR storage. Like DYN_SOA_OF, each macro
+// defines a struct and its functions, so use them at file scope. A zeroed
+// map is empty.
+//
+// DYN_FLAT_MAP_OF(name, key_type, value_type, less) is a sorted array of
+// name_entry {key, value}, for maps that are read much more than written:
+//   name_lower_bound(m, key)  index of the first entry not less than key
+//   name_find(m, key)         pointer to the value, or NULL
+//   name_insert(m, key, value)
+//   name_insert_batch(m, entries, count)  sorts and merges count entries at
+//                             once; later duplicates win
+//   name_erase(m, key)        1 if it was there
+//   name_destroy(m)
+// m->entries is the DYN_ARR of entries, in order.
+//
+// DYN_HASH_MAP_OF(name, key_type, value_type, hash, equal) is an open
+// addressing hash table with a control byte per slot, compared 16 at a time
+// (with SSE2 when available). Probing is linear, and erasing shifts the
+// following entries back rather than leaving tombstones, so lookups never
+// slow down with churn:
+//   name_find(m, key), name_insert(m, key, value), name_erase(m, key),
+//   name_reserve(m, count), name_destroy(m)
+// and DYN_HASH_MAP_FOREACH(m, i) visits the slots in use, m->slots.data[i].
+//
+// less(a, b), hash(key) and equal(a, b) can be functions or macros;
+// DYN_MAP_LESS, dyn_map_hash_u64 and DYN_MAP_EQUAL suit integer keys.
+
+#define DYN_MAP_LESS(a, b) ((a) < (b))
+#define DYN_MAP_EQUAL(a, b) ((a) == (b))
+
+// Mixes all the bits of x into all the others.
+static inline uint64_t dyn_map_hash_u64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+#define DYN_FLAT_MAP_OF(name, key_type, value_type, less) \
+typedef struct name##_entry { \
+  key_type key; \
+  value_type value; \
+} name##_entry; \
+\
+typedef struct name { \
+  DYN_ARR_OF(name##_entry) entries; \
+} name; \
+\
+/* Halves the range without branching on the comparison, so there are no */ \
+/* mispredictions for the compiler to make. */ \
+static inline size_t name##_lower_bound(const name *m, key_type key) { \
+  const name##_entry *base = m->entries.data; \
+  size_t n = DYN_ARR_SIZE(m->entries); \
+  if (n == 0) return 0; \
+  while (n > 1) { \
+    size_t half = n / 2; \
+    base = less(base[half].key, key) ? base + half : base; \
+    n -= half; \
+  } \
+  return (size_t)(base - m->entries.data) + (less(base->key, key) ? 1u : 0u); \
+} \
+\
+static inline value_type *name##_find(name *m, key_type key) { \
+  size_t i = name##_lower_bound(m, key); \
+  if (i < DYN_ARR_SIZE(m->entries) && !less(key, m->entries.data[i].key)) { \
+    return &m->entries.data[i].value; \
+  } \
+  return NULL; \
+} \
+\
+static inline void name##_insert(name *m, key_type key, value_type value) { \
+  size_t i = name##_lower_bound(m, key); \
+  size_t size = DYN_ARR_SIZE(m->entries); \
+  if (i < size && !less(key, m->entries.data[i].key)) { \
+    m->entries.data[i].value = value; \
+    return; \
+  } \
+  name##_entry *added; \
+  DYN_ARR_EXTEND_UNINIT(m->entries, 1u, added); \
+  (void)added; \
+  memmove(&m->entries.data[i + 1], &m->entries.data[i], sizeof(name##_entry) * (size - i)); \
+  m->entries.data[i].key = key; \
+  m->entries.data[i].value = value; \
+} \
+\
+static inline int name##_erase(name *m, key_type key) { \
+  size_t i = name##_lower_bound(m, key); \
+  size_t size = DYN_ARR_SIZE(m->entries); \
+  if (i == size || less(key, m->entries.data[i].key)) return 0; \
+  memmove(&m->entries.data[i], &m->entries.data[i + 1], sizeof(name##_entry) * (size - i - 1)); \
+  DYN_ARR_POP(m->entries); \
+  return 1; \
+} \
+\
+static inline int name##__compare(const void *a, const void *b) { \
+  const name##_entry *x = (const name##_entry *)a, *y = (const name##_entry *)b; \
+  return less(x->key, y->key) ? -1 : less(y->key, x->key) ? 1 : 0; \
+} \
+\
+/* Sorts the batch, updates the keys already there, and then merges the */ \
+/* new ones in from the back, so each entry moves at most once. */ \
+static inline void name##_insert_batch(name *m, const name##_entry *batch, size_t count) { \
+  if (count == 0) return; \
+  name##_entry *sorted = (name##_entry *)malloc(sizeof(name##_entry) * count); \
+  assert(sorted != NULL); \
+  memcpy(sorted, batch, sizeof(name##_entry) * count); \
+  dyn_arr_sort(sorted, count, sizeof(name##_entry), name##__compare); \
+  size_t fresh = 0; \
+  for (size_t i = 0; i < count; ++i) { \
+    if (i + 1 < count && !less(sorted[i].key, sorted[i + 1].key)) continue; /* a later one wins */ \
+    value_type *existing = name##_find(m, sorted[i].key); \
+    if (existing != NULL) { \
+      *existing = sorted[i].value; \
+    } else { \
+      sorted[fresh++] = sorted[i]; \
+    } \
+  } \
+  size_t old_size = DYN_ARR_SIZE(m->entries); \
+  name##_entry *added; \
+  DYN_ARR_EXTEND_UNINIT(m->entries, fresh, added); \
+  (void)added; \
+  name##_entry *data = m->entries.data; \
+  size_t i = old_size, j = fresh, k = old_size + fresh; \
+  while (j > 0) { \
+    if (i > 0 && less(sorted[j - 1].key, data[i - 1].key)) { \
+      data[--k] = data[--i]; \
+    } else { \
+      data[--k] = sorted[--j]; \
+    } \
+  } \
+  free(sorted); \
+} \
+\
+static inline void name##_destroy(name *m) { \
+  DYN_ARR_DESTROY(m->entries); \
+}
+
+// Control bytes: empty, or the top 7 bits of a full slot's hash.
+#define DYN_MAP_GROUP 16u
+#define DYN_MAP_EMPTY 0x80u
+
+// Bit i is set where group[i] == byte.
+static inline uint32_t dyn_map__match(const uint8_t *group, uint8_t byte) {
+#if defined __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+  uint32_t bits = 0;
+  for (unsigned i = 0; i < DYN_MAP_GROUP; ++i) {
+    bits |= (uint32_t)(group[i] == byte) << i;
+  }
+  return bits;
+#endif
+}
+
+static inline uint32_t dyn_map__match_empty(const uint8_t *group) {
+#if defined __SSE2__
+  // Only empty bytes have the top bit set.
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+  return dyn_map__match(group, DYN_MAP_EMPTY);
+#endif
+}
+
+#define DYN_HASH_MAP_OF(name, key_type, value_type, hash, equal) \
+typedef struct name##_entry { \
+  key_type key; \
+  value_type value; \
+} name##_entry; \
+\
+typedef struct name { \
+  DYN_ARR_OF(name##_entry) slots; /* a power of two, at least a group */ \
+  DYN_ARR_OF(uint8_t) ctrl; /* a byte per slot, then a copy of the first group */ \
+  size_t size; \
+} name; \
+\
+static inline void name##__set_ctrl(name *m, size_t i, uint8_t byte) { \
+  m->ctrl.data[i] = byte; \
+  if (i < DYN_MAP_GROUP) m->ctrl.data[DYN_ARR_SIZE(m->slots) + i] = byte; \
+} \
+\
+/* The slot holding key, or SIZE_MAX. */ \
+static inline size_t name##__index(const name *m, key_type key, uint64_t h) { \
+  size_t mask = (size_t)DYN_ARR_SIZE(m->slots) - 1u; \
+  if (m->size == 0) return SIZE_MAX; \
+  uint8_t h2 = (uint8_t)(h >> 57); \
+  for (size_t pos = (size_t)h & mask;; pos = (pos + DYN_MAP_GROUP) & mask) { \
+    const uint8_t *group = m->ctrl.data + pos; \
+    for (uint32_t bits = dyn_map__match(group, h2); bits != 0; bits &= bits - 1u) { \
+      size_t i = (pos + (size_t)__builtin_ctz(bits)) & mask; \
+      if (equal(m->slots.data[i].key, key)) return i; \
+    } \
+    /* Entries sit between their hash's slot and the next empty one. */ \
+    if (dyn_map__match_empty(group) != 0) return SIZE_MAX; \
+  } \
+} \
+\
+static inline value_type *name##_find(name *m, key_type key) { \
+  size_t i = name##__index(m, key, (uint64_t)hash(key)); \
+  return i == SIZE_MAX ? NULL : &m->slots.data[i].value; \
+} \
+\
+/* Puts an entry that isn't there yet in the first empty slot from its */ \
+/* hash's. */ \
+static inline void name##__place(name *m, name##_entry entry, uint64_t h) { \
+  size_t mask = (size_t)DYN_ARR_SIZE(m->slots) - 1u; \
+  for (size_t pos = (size_t)h & mask;; pos = (pos + DYN_MAP_GROUP) & mask) { \
+    uint32_t empty = dyn_map__match_empty(m->ctrl.data + pos); \
+    if (empty != 0) { \
+      size_t i = (pos + (size_t)__builtin_ctz(empty)) & mask; \
+      name##__set_ctrl(m, i, (uint8_t)(h >> 57)); \
+      m->slots.data[i] = entry; \
+      ++m->size; \
+      return; \
+    } \
+  } \
+} \
+\
+static inline void name##__rehash(name *m, size_t capacity) { \
+  name old = *m; \
+  DYN_ARR_RESET(m->slots, 0u); \
+  DYN_ARR_RESIZE(m->slots, capacity); \
+  DYN_ARR_RESET(m->ctrl, 0u); \
+  DYN_ARR_RESIZE(m->ctrl, capacity + DYN_MAP_GROUP); \
+  memset(m->ctrl.data, DYN_MAP_EMPTY, capacity + DYN_MAP_GROUP); \
+  m->size = 0; \
+  for (size_t i = 0; i < DYN_ARR_SIZE(old.slots); ++i) { \
+    if (old.ctrl.data[i] != DYN_MAP_EMPTY) { \
+      name##__place(m, old.slots.data[i], (uint64_t)hash(old.slots.data[i].key)); \
+    } \
+  } \
+  DYN_ARR_DESTROY(old.slots); \
+  DYN_ARR_DESTROY(old.ctrl); \
+} \
+\
+/* Makes room for count entries without rehashing, at 7/8 full at most. */ \
+static inline void name##_reserve(name *m, size_t count) { \
+  size_t capacity = DYN_MAP_GROUP; \
+  while (capacity / 8u * 7u < count) capacity *= 2u; \
+  if (capacity > DYN_ARR_SIZE(m->slots)) name##__rehash(m, capacity); \
+} \
+\
+static inline void name##_insert(name *m, key_type key, value_type value) { \
+  uint64_t h = (uint64_t)hash(key); \
+  size_t i = name##__index(m, key, h); \
+  if (i != SIZE_MAX) { \
+    m->slots.data[i].value = value; \
+    return; \
+  } \
+  name##_reserve(m, m->size + 1u); \
+  name##_entry entry; \
+  entry.key = key; \
+  entry.value = value; \
+  name##__place(m, entry, h); \
+} \
+\
+/* Moves each following entry back into the gap if that doesn't put it */ \
+/* before its hash's slot, until an empty slot. */ \
+static inline int name##_erase(name *m, key_type key) { \
+  size_t i = name##__index(m, key, (uint64_t)hash(key)); \
+  if (i == SIZE_MAX) return 0; \
+  size_t mask = (size_t)DYN_ARR_SIZE(m->slots) - 1u; \
+  for (size_t j = (i + 1u) & mask; m->ctrl.data[j] != DYN_MAP_EMPTY; j = (j + 1u) & mask) { \
+    size_t home = (size_t)hash(m->slots.data[j].key) & mask; \
+    int stays = i < j ? (i < home && home <= j) : (i < home || home <= j); \
+    if (!stays) { \
+      m->slots.data[i] = m->slots.data[j]; \
+      name##__set_ctrl(m, i, m->ctrl.data[j]); \
+      i = j; \
+    } \
+  } \
+  name##__set_ctrl(m, i, DYN_MAP_EMPTY); \
+  --m->size; \
+  return 1; \
+} \
+\
+static inline void name##_destroy(name *m) { \
+  DYN_ARR_DESTROY(m->slots); \
+  DYN_ARR_DESTROY(m->ctrl); \
+  m->size = 0; \
+}
+
+#define DYN_HASH_MAP_FOREACH(m, countername) \
+for (size_t countername = 0; (countername) < DYN_ARR_SIZE((m).slots); ++(countername)) \
+  if ((m).ctrl.data[countername] != DYN_MAP_EMPTY)
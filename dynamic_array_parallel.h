@@ -0,0 +1,435 @@
+#pragma once
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dynamic_array.h"
+
+// A thread pool and parallel algorithms over DYN_ARR arrays (or any plain
+// array): for, reduce, radix sort for unsigned integer keys and a stable
+// merge sort. Results don't depend on the number of threads.
+//
+// Work is split into chunks, and each thread starts with an even share of
+// them. A thread that runs out steals the top half of another's share, so
+// uneven chunks still keep every thread busy. The calling thread works too.
+// Only one thread at a time may start work on a pool, and not from inside a
+// body.
+//
+//   dyn_arr_thread_pool pool;
+//   dyn_arr_thread_pool_init(&pool, 0); // one thread per core
+//   DYN_ARR_PARALLEL_RADIX_SORT(&pool, keys);
+//   DYN_ARR_PARALLEL_SORT(&pool, points, compare_points);
+//   dyn_arr_thread_pool_destroy(&pool);
+
+#define DYN_ARR_MAX_THREADS 64u
+
+typedef struct dyn_arr_thread_pool {
+  pthread_t threads[DYN_ARR_MAX_THREADS];
+  unsigned thread_count; // including the caller
+  pthread_mutex_t mutex;
+  pthread_cond_t wake, done;
+  uint64_t generation;
+  unsigned busy; // threads still inside the current job
+  int stopping;
+
+  // The current job: chunk_count calls of run(job, chunk).
+  void (*run)(void *job, size_t chunk);
+  void *job;
+  // Each thread's share of the chunks, as lo | hi << 32.
+  uint64_t ranges[DYN_ARR_MAX_THREADS];
+} dyn_arr_thread_pool;
+
+typedef struct dyn_arr__worker {
+  dyn_arr_thread_pool *pool;
+  unsigned index;
+} dyn_arr__worker;
+
+static inline uint64_t dyn_arr__range(uint64_t lo, uint64_t hi) {
+  return lo | hi << 32;
+}
+
+// Takes the next chunk of thread index's share, or steals from another
+// thread when that's empty. Returns 0 when there's nothing left anywhere.
+static inline int dyn_arr__next_chunk(dyn_arr_thread_pool *pool, unsigned index, size_t *chunk) {
+  uint64_t *mine = &pool->ranges[index];
+  for (;;) {
+    uint64_t range = __atomic_load_n(mine, __ATOMIC_ACQUIRE);
+    uint64_t lo = range & 0xffffffffu, hi = range >> 32;
+    if (lo < hi) {
+      if (__atomic_compare_exchange_n(mine, &range, dyn_arr__range(lo + 1, hi), 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        *chunk = lo;
+        return 1;
+      }
+      continue;
+    }
+    // Steal the top half of the biggest share left.
+    unsigned victim = index;
+    uint64_t most = 0;
+    for (unsigned i = 0; i < pool->thread_count; ++i) {
+      uint64_t other = __atomic_load_n(&pool->ranges[i], __ATOMIC_ACQUIRE);
+      uint64_t left = (other >> 32) - (other & 0xffffffffu);
+      if ((other >> 32) > (other & 0xffffffffu) && left > most) {
+        most = left;
+        victim = i;
+      }
+    }
+    if (most == 0) return 0;
+    uint64_t other = __atomic_load_n(&pool->ranges[victim], __ATOMIC_ACQUIRE);
+    uint64_t other_lo = other & 0xffffffffu, other_hi = other >> 32;
+    if (other_lo >= other_hi) continue;
+    uint64_t mid = other_hi - (other_hi - other_lo + 1) / 2;
+    if (__atomic_compare_exchange_n(&pool->ranges[victim], &other, dyn_arr__range(other_lo, mid), 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      // Only this thread refills its own share, so a plain store will do.
+      __atomic_store_n(mine, dyn_arr__range(mid, other_hi), __ATOMIC_RELEASE);
+    }
+  }
+}
+
+static inline void dyn_arr__work(dyn_arr_thread_pool *pool, unsigned index) {
+  size_t chunk;
+  while (dyn_arr__next_chunk(pool, index, &chunk)) {
+    pool->run(pool->job, chunk);
+  }
+}
+
+static inline void *dyn_arr__worker_main(void *arg) {
+  dyn_arr__worker *worker = (dyn_arr__worker *)arg;
+  dyn_arr_thread_pool *pool = worker->pool;
+  unsigned index = worker->index;
+  free(worker);
+  uint64_t seen = 0;
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while (pool->generation == seen && !pool->stopping) {
+      pthread_cond_wait(&pool->wake, &pool->mutex);
+    }
+    if (pool->stopping) break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+    dyn_arr__work(pool, index);
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+// threads counts the caller; 0 means one per core.
+static inline void dyn_arr_thread_pool_init(dyn_arr_thread_pool *pool, unsigned threads) {
+  if (threads == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cores > 0 ? (unsigned)cores : 1u;
+  }
+  if (threads > DYN_ARR_MAX_THREADS) threads = DYN_ARR_MAX_THREADS;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->generation = 0;
+  pool->busy = 0;
+  pool->stopping = 0;
+  pool->thread_count = 1;
+  for (unsigned i = 1; i < threads; ++i) {
+    dyn_arr__worker *worker = (dyn_arr__worker *)malloc(sizeof(dyn_arr__worker));
+    assert(worker != NULL);
+    worker->pool = pool;
+    worker->index = i;
+    if (pthread_create(&pool->threads[i], NULL, dyn_arr__worker_main, worker) != 0) {
+      free(worker);
+      break;
+    }
+    pool->thread_count = i + 1;
+  }
+}
+
+static inline void dyn_arr_thread_pool_destroy(dyn_arr_thread_pool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->mutex);
+  for (unsigned i = 1; i < pool->thread_count; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->mutex);
+}
+
+// Calls run(job, chunk) for every chunk below chunk_count, across the pool,
+// and returns when they're all done.
+static inline void dyn_arr__run_chunks(dyn_arr_thread_pool *pool, size_t chunk_count,
+                                       void (*run)(void *job, size_t chunk), void *job) {
+  assert(chunk_count <= 0xffffffffu);
+  if (chunk_count == 0) return;
+  if (pool == NULL || pool->thread_count == 1 || chunk_count == 1) {
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) run(job, chunk);
+    return;
+  }
+  unsigned threads = pool->thread_count;
+  for (unsigned i = 0; i < threads; ++i) {
+    pool->ranges[i] = dyn_arr__range(chunk_count * i / threads, chunk_count * (i + 1) / threads);
+  }
+  pthread_mutex_lock(&pool->mutex);
+  pool->run = run;
+  pool->job = job;
+  pool->busy = threads - 1;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->mutex);
+
+  dyn_arr__work(pool, 0);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+// How many elements go in a chunk if the caller doesn't say: enough chunks
+// for stealing to even things out on any pool. It depends on count alone,
+// so chunk boundaries, and the order a reduce combines partials in, don't
+// change with the number of threads.
+#define DYN_ARR__DEFAULT_CHUNKS 512u
+
+static inline size_t dyn_arr__chunk_size(size_t count, size_t chunk) {
+  if (chunk > 0) return chunk;
+  chunk = count / DYN_ARR__DEFAULT_CHUNKS;
+  return chunk < 1024u ? 1024u : chunk;
+}
+
+typedef struct dyn_arr__for_job {
+  void (*body)(void *ctx, size_t begin, size_t end);
+  void *ctx;
+  size_t count, chunk;
+} dyn_arr__for_job;
+
+static inline void dyn_arr__for_chunk(void *job, size_t chunk) {
+  dyn_arr__for_job *f = (dyn_arr__for_job *)job;
+  size_t begin = chunk * f->chunk;
+  size_t end = begin + f->chunk < f->count ? begin + f->chunk : f->count;
+  f->body(f->ctx, begin, end);
+}
+
+// Calls body(ctx, begin, end) on ranges covering [0, count), chunk elements
+// at a time (0 picks a size).
+static inline void dyn_arr_parallel_for(dyn_arr_thread_pool *pool, size_t count, size_t chunk,
+                                        void (*body)(void *ctx, size_t begin, size_t end), void *ctx) {
+  dyn_arr__for_job job = {body, ctx, count, dyn_arr__chunk_size(count, chunk)};
+  dyn_arr__run_chunks(pool, (count + job.chunk - 1) / job.chunk, dyn_arr__for_chunk, &job);
+}
+
+#define DYN_ARR_PARALLEL_FOR(pool, a, chunk, body, ctx) \
+  dyn_arr_parallel_for((pool), DYN_ARR_SIZE(a), (chunk), (body), (ctx))
+
+typedef struct dyn_arr__reduce_job {
+  void (*body)(void *ctx, size_t begin, size_t end, void *partial);
+  void *ctx;
+  size_t count, chunk, result_size;
+  char *partials;
+} dyn_arr__reduce_job;
+
+static inline void dyn_arr__reduce_chunk(void *job, size_t chunk) {
+  dyn_arr__reduce_job *r = (dyn_arr__reduce_job *)job;
+  size_t begin = chunk * r->chunk;
+  size_t end = begin + r->chunk < r->count ? begin + r->chunk : r->count;
+  r->body(r->ctx, begin, end, r->partials + chunk * r->result_size);
+}
+
+// Reduces [0, count) into *result, which starts as the identity. Each chunk
+// gets its own copy of the identity to accumulate into with body, and then
+// the partials are combined in chunk order, so the result is the same
+// whatever the number of threads, even for floating point.
+static inline void dyn_arr_parallel_reduce(dyn_arr_thread_pool *pool, size_t count, size_t chunk,
+                                           void *result, size_t result_size,
+                                           void (*body)(void *ctx, size_t begin, size_t end, void *partial),
+                                           void (*combine)(void *ctx, void *into, const void *from),
+                                           void *ctx) {
+  dyn_arr__reduce_job job = {body, ctx, count, dyn_arr__chunk_size(count, chunk), result_size, NULL};
+  size_t chunk_count = (count + job.chunk - 1) / job.chunk;
+  if (chunk_count == 0) return;
+  job.partials = (char *)malloc(chunk_count * result_size);
+  assert(job.partials != NULL);
+  for (size_t i = 0; i < chunk_count; ++i) {
+    memcpy(job.partials + i * result_size, result, result_size);
+  }
+  dyn_arr__run_chunks(pool, chunk_count, dyn_arr__reduce_chunk, &job);
+  for (size_t i = 0; i < chunk_count; ++i) {
+    combine(ctx, result, job.partials + i * result_size);
+  }
+  free(job.partials);
+}
+
+#define DYN_ARR_PARALLEL_REDUCE(pool, a, chunk, result, body, combine, ctx) \
+  dyn_arr_parallel_reduce((pool), DYN_ARR_SIZE(a), (chunk), (result), sizeof(*(result)), \
+                          (body), (combine), (ctx))
+
+// LSD radix sort, a byte at a time, of unsigned 4- or 8-byte keys. Each pass
+// counts digits per block in parallel, works out where each block's keys go,
+// and then scatters the blocks in parallel. Passes where every key has the
+// same digit are skipped.
+#define DYN_ARR__RADIX_BLOCKS_PER_THREAD 4u
+
+typedef struct dyn_arr__radix_job {
+  const char *from;
+  char *to;
+  size_t count, block;
+  unsigned shift;
+  size_t (*counts)[256]; // per block: the histogram, then the offsets
+} dyn_arr__radix_job;
+
+// The loops, for each key type, so the compiler sees plain loads and stores.
+#define DYN_ARR__RADIX_LOOPS(key_type, count_name, scatter_name) \
+static inline void count_name(void *job, size_t block) { \
+  dyn_arr__radix_job *r = (dyn_arr__radix_job *)job; \
+  const key_type *from = (const key_type *)r->from; \
+  size_t begin = block * r->block; \
+  size_t end = begin + r->block < r->count ? begin + r->block : r->count; \
+  size_t *counts = r->counts[block]; \
+  unsigned shift = r->shift; \
+  memset(counts, 0, sizeof(r->counts[0])); \
+  for (size_t i = begin; i < end; ++i) { \
+    ++counts[(from[i] >> shift) & 0xffu]; \
+  } \
+} \
+\
+static inline void scatter_name(void *job, size_t block) { \
+  dyn_arr__radix_job *r = (dyn_arr__radix_job *)job; \
+  const key_type *from = (const key_type *)r->from; \
+  key_type *to = (key_type *)r->to; \
+  size_t begin = block * r->block; \
+  size_t end = begin + r->block < r->count ? begin + r->block : r->count; \
+  size_t *offsets = r->counts[block]; \
+  unsigned shift = r->shift; \
+  for (size_t i = begin; i < end; ++i) { \
+    to[offsets[(from[i] >> shift) & 0xffu]++] = from[i]; \
+  } \
+}
+
+DYN_ARR__RADIX_LOOPS(uint32_t, dyn_arr__radix_count32, dyn_arr__radix_scatter32)
+DYN_ARR__RADIX_LOOPS(uint64_t, dyn_arr__radix_count64, dyn_arr__radix_scatter64)
+
+static inline void dyn_arr_parallel_radix_sort(dyn_arr_thread_pool *pool, void *keys, size_t count, size_t key_size) {
+  assert(key_size == 4 || key_size == 8);
+  if (count < 2) return;
+  size_t threads = pool != NULL ? pool->thread_count : 1u;
+  size_t blocks = threads * DYN_ARR__RADIX_BLOCKS_PER_THREAD;
+  if (blocks > count) blocks = count;
+  dyn_arr__radix_job job;
+  job.count = count;
+  job.block = (count + blocks - 1) / blocks;
+  blocks = (count + job.block - 1) / job.block;
+  job.counts = (size_t(*)[256])malloc(blocks * sizeof(job.counts[0]));
+  char *spare = (char *)malloc(count * key_size);
+  assert(job.counts != NULL && spare != NULL);
+  job.from = (const char *)keys;
+  job.to = spare;
+  void (*count_block)(void *, size_t) = key_size == 8 ? dyn_arr__radix_count64 : dyn_arr__radix_count32;
+  void (*scatter_block)(void *, size_t) = key_size == 8 ? dyn_arr__radix_scatter64 : dyn_arr__radix_scatter32;
+  for (job.shift = 0; job.shift < key_size * 8u; job.shift += 8u) {
+    dyn_arr__run_chunks(pool, blocks, count_block, &job);
+    size_t total = 0;
+    int one_digit = 0;
+    for (unsigned digit = 0; digit < 256u; ++digit) {
+      size_t digit_count = 0;
+      for (size_t b = 0; b < blocks; ++b) {
+        size_t n = job.counts[b][digit];
+        job.counts[b][digit] = total;
+        total += n;
+        digit_count += n;
+      }
+      if (digit_count == count) one_digit = 1;
+    }
+    if (one_digit) continue;
+    dyn_arr__run_chunks(pool, blocks, scatter_block, &job);
+    char *from = job.to;
+    job.to = (char *)job.from;
+    job.from = from;
+  }
+  if (job.from != keys) memcpy(keys, job.from, count * key_size);
+  free(spare);
+  free(job.counts);
+}
+
+// Sorts a DYN_ARR of uint32_t or uint64_t (or other unsigned keys that size).
+#define DYN_ARR_PARALLEL_RADIX_SORT(pool, a) \
+  dyn_arr_parallel_radix_sort((pool), a.data, DYN_ARR_SIZE(a), sizeof(a.data[0]))
+
+// Stable merge sort: blocks are sorted in parallel, then merged in pairs,
+// each round's merges in parallel. The last rounds have fewer pairs than
+// threads, so each merge is also split into pieces of its output: a binary
+// search (the co-rank) finds how much of each side goes before a piece, and
+// the pieces merge independently.
+typedef struct dyn_arr__sort_job {
+  char *data, *spare;
+  size_t count, size, run;
+  size_t pieces; // per pair, this round
+  int (*compare)(const void *, const void *);
+} dyn_arr__sort_job;
+
+static inline void dyn_arr__sort_block(void *job, size_t block) {
+  dyn_arr__sort_job *s = (dyn_arr__sort_job *)job;
+  size_t begin = block * s->run;
+  size_t n = s->count - begin < s->run ? s->count - begin : s->run;
+  dyn_arr__merge_sort(s->data + begin * s->size, s->spare + begin * s->size, n, s->size, s->compare);
+}
+
+// How many of the first k elements of the stable merge of left and right
+// come from left. Ties take from the left, as in dyn_arr__merge.
+static inline size_t dyn_arr__co_rank(const char *left, size_t left_count, const char *right, size_t right_count,
+                                      size_t k, size_t size, int (*compare)(const void *, const void *)) {
+  size_t lo = k > right_count ? k - right_count : 0;
+  size_t hi = k < left_count ? k : left_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    // left[mid] is among the first k if it doesn't come after right[k - mid - 1].
+    if (compare(right + (k - mid - 1) * size, left + mid * size) >= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static inline void dyn_arr__merge_piece(void *job, size_t piece) {
+  dyn_arr__sort_job *s = (dyn_arr__sort_job *)job;
+  size_t begin = piece / s->pieces * 2 * s->run;
+  size_t part = piece % s->pieces;
+  size_t left = s->count - begin < s->run ? s->count - begin : s->run;
+  size_t right = s->count - begin - left < s->run ? s->count - begin - left : s->run;
+  const char *l = s->data + begin * s->size, *r = l + left * s->size;
+  size_t k0 = (left + right) * part / s->pieces, k1 = (left + right) * (part + 1) / s->pieces;
+  size_t i0 = dyn_arr__co_rank(l, left, r, right, k0, s->size, s->compare);
+  size_t i1 = dyn_arr__co_rank(l, left, r, right, k1, s->size, s->compare);
+  dyn_arr__merge(l + i0 * s->size, i1 - i0, r + (k0 - i0) * s->size, (k1 - i1) - (k0 - i0),
+                 s->spare + (begin + k0) * s->size, s->size, s->compare);
+}
+
+static inline void dyn_arr_parallel_merge_sort(dyn_arr_thread_pool *pool, void *data, size_t count, size_t size,
+                                               int (*compare)(const void *, const void *)) {
+  if (count < 2) return;
+  dyn_arr__sort_job job = {(char *)data, NULL, count, size, 0, 1, compare};
+  job.spare = (char *)malloc(count * size);
+  assert(job.spare != NULL);
+  size_t threads = pool != NULL ? pool->thread_count : 1u;
+  size_t blocks = threads * 2u;
+  job.run = (count + blocks - 1) / blocks;
+  dyn_arr__run_chunks(pool, (count + job.run - 1) / job.run, dyn_arr__sort_block, &job);
+  for (; job.run < count; job.run *= 2) {
+    size_t pairs = (count + 2 * job.run - 1) / (2 * job.run);
+    job.pieces = (blocks + pairs - 1) / pairs;
+    dyn_arr__run_chunks(pool, pairs * job.pieces, dyn_arr__merge_piece, &job);
+    char *swap = job.data;
+    job.data = job.spare;
+    job.spare = swap;
+  }
+  if (job.data != (char *)data) {
+    memcpy(data, job.data, count * size);
+    job.spare = job.data;
+  }
+  free(job.spare);
+}
+
+// compare is qsort's.
+#define DYN_ARR_PARALLEL_SORT(pool, a, compare) \
+  dyn_arr_parallel_merge_sort((pool), a.data, DYN_ARR_SIZE(a), sizeof(a.data[0]), (compare))
@@ -21,7 +21,22 @@
 //
 // fmt functions need to be defined as macros, because the varargs include
 // type information and a sentinel. See the implementations of fmt_sn(),
-// fmt_fprint(), and fmt_malloc() for examples.
+// fmt_fprint(), and fmt_malloc() for examples. They pass the format string and
+// arguments with FMT_VA_ARGS(fmt, ##__VA_ARGS__) (or FMT_SCAN_VA_ARGS for
+// scanning).
+//
+// Compact mode:
+// If you #define FMT_COMPACT 1 before including fmt.h (in every translation
+// unit), FmtState is kept small for code with many small stacks:
+// * The arguments aren't copied into FmtState. FMT_VA_ARGS passes a pointer to
+//   an array of them instead, which lives in the caller's stack frame. So the
+//   varargs of fmt_init() and the *_va functions are different, and code
+//   built with and without compact mode can't call each other's.
+// * text_buf is FMT_SHOW_BUF_MAX bytes, which is 24 by default. (You can
+//   #define FMT_SHOW_BUF_MAX yourself in either mode; it has to be at least
+//   24.) Binary numbers that don't fit are streamed.
+// * fmt_fprint() formats into a per-thread buffer rather than a 4 KB buffer on
+//   the stack.
 //
 // To handle custom arguments:
 // 1. In each translation unit, before including fmt.h, define
@@ -61,16 +76,30 @@
 // * fmt is a printf-style format specifier:
 //   It consists of a total formatted size (possibly preceded by 0 to use '0'
 //   instead of ' ' for padding), followed by one of the characters x (hexadecimal),
-//   b (binary), c (character), or p (pointer). All parts are optional.
+//   X (uppercase hexadecimal), b (binary), c (character), h (hexdump), or p
+//   (pointer). All parts are optional.
 //   :p can be applied to any argument to print it as a pointer (note: if the
 //   argument is smaller than a pointer, this will read adjacent memory). The
-//   other specifiers are for integer types.
+//   other specifiers are for integer types and byte spans.
+//   It can end with j (JSON string) or q (C string) to escape the formatted
+//   text as it's written. Quotes aren't added, so write them in the format
+//   string. Padding is calculated from the escaped size.
 // * custom is a string passed into the custom formatting function.
 // Examples:
 //   {}        // print next argument with default formatting
 //   {1:08}    // print second argument as 8 bytes, padded with 0s.
 //   {4|hello} // print fifth argument, passing "hello" to fmt_custom_arg
 //   {:p}      // print next argument as a pointer
+//   "{:j}"    // print next argument as the contents of a JSON string
+//   {:h}      // print fmt_bytes(ptr, size) like hexdump -C
+//   {:x| }    // print fmt_array(ptr, count) in hex, separated by spaces
+//
+// Text is assumed to be UTF-8, and the size for padding is counted in code
+// points. If you #define FMT_DISPLAY_WIDTH 1 before including fmt.h (in the
+// translation unit with FMT_IMPL), East Asian wide characters count as two
+// columns instead, so tables line up in a terminal.
+// {:c} prints integers bigger than 127 as UTF-8 (char-sized types are
+// printed as a raw byte).
 //
 // fmt.h requires C11 _Generic and the GNU __typeof__ extension, which means
 // it's compatible with gcc, clang, and tcc, but not e.g. MSVC.
@@ -83,8 +112,6 @@
 // TODO: Floating point support would probably be nice. For now you can
 // implement it yourself in terms of snprintf (see main.c).
 
-// TODO: UTF-8 for {:c}?
-
 // TODO: Maybe fmt_custom_arg should always be called if {|...} is passed,
 // even for known types.
 
@@ -95,10 +122,16 @@
 
 typedef int32_t FmtArgType;
 
-enum {
-  // show_U64_bin assumes this is at least 64.
-  FMT_SHOW_BUF_MAX = 64,
-};
+#if !defined FMT_COMPACT
+  #define FMT_COMPACT 0
+#endif
+
+#if !defined FMT_SHOW_BUF_MAX
+  #define FMT_SHOW_BUF_MAX (FMT_COMPACT ? 24 : 64)
+#endif
+
+// Error messages and 64-bit numbers (other than binary ones) have to fit.
+_Static_assert(FMT_SHOW_BUF_MAX >= 24, "FMT_SHOW_BUF_MAX is too small");
 
 typedef enum FmtPadMode {
   FmtPadLeft,
@@ -112,15 +145,42 @@ typedef struct FmtArg {
   FmtArgType type;
 } FmtArg;
 
+// A span of bytes to print in hexadecimal. Use fmt_bytes() to pass one as an
+// argument. The bytes are streamed, so they can be any length.
+typedef struct FmtBytes {
+  const void *data;
+  size_t size;
+} FmtBytes;
+
+#define fmt_bytes(data, size) ((FmtBytes){(data), (size)})
+
+// An array of count values of any type fmt can print. Use fmt_array() to pass
+// one as an argument, e.g. fmt_array(arr.data, DYN_ARR_SIZE(arr)).
+// The format spec applies to each element, and the custom string is the
+// separator (", " if there's no custom string), so {:08x|:} prints each
+// element in hex, padded to 8 characters, separated by colons. Elements are
+// formatted without userdata or a custom string.
+typedef struct FmtArray {
+  const void *data;
+  size_t count;
+  size_t elem_size;
+  FmtArgType type;
+} FmtArray;
+
+#define fmt_array(data, count) \
+  ((FmtArray){(data), (count), sizeof(*(data)), FMT_MAKE_FMTTYPE(*(data))})
+
 typedef struct FmtSpec {
-  size_t min_len; // in bytes; should be in code points?
+  size_t min_len; // in code points (or columns, with FMT_DISPLAY_WIDTH)
   const char *custom_start;
   size_t custom_len;
   FmtPadMode pad_mode;
   char pad_byte;
-   // 0 for default, 'b' for binary, 'x' for hexadecimal, 'c' for character, 'p'
-   // for pointer
+   // 0 for default, 'b' for binary, 'x' for hexadecimal, 'X' for uppercase
+   // hexadecimal, 'h' for a hexdump, 'c' for character, 'p' for pointer
   char format;
+  // 0 for none, 'j' for JSON string escaping, 'q' for C string escaping
+  char escape;
 } FmtSpec;
 
 // Rename this!
@@ -131,6 +191,27 @@ typedef struct FmtFormatOutput {
   int pad_size;
   FmtPadMode pad_mode;
   char pad_byte;
+  // Copied from FmtSpec. text is escaped while it's written out, so it may
+  // take more room than text_size.
+  char escape;
+  // How much of an escape sequence was written when the buffer ran out.
+  int escape_partial;
+  // Text that's too long for a buffer can be streamed instead. After text is
+  // written out, stream is called with the remaining space in the output
+  // buffer, and should write as much as fits and return the size. When it's
+  // written everything, it sets stream to 0. If buf is 0, it should return the
+  // size of the rest of its output without writing anything.
+  // The other stream_ fields are for the stream function to keep track of
+  // where it is. A stream can also point text (and the padding and escape
+  // fields) at more output, which is written before it's called again.
+  size_t (*stream)(struct FmtFormatOutput *format_output,
+                   char *buf, size_t size);
+  const void *stream_arg;
+  size_t stream_pos;
+  size_t stream_skip;
+  FmtSpec stream_spec;
+  // The text_buf that text pointed to at the start, for the stream to use.
+  char *stream_buf;
 } FmtFormatOutput;
 
 bool fmt_custom_arg(FmtArg arg, FmtSpec spec,
@@ -145,7 +226,11 @@ typedef enum FmtAction {
 } FmtAction;
 
 typedef struct FmtState {
+#if FMT_COMPACT
+  const FmtArg *args;
+#else
   FmtArg args[FMT_MAX_ARGS];
+#endif
   int arg_count;
 
   const char *fmt_at_init;
@@ -164,7 +249,9 @@ typedef struct FmtState {
 } FmtState;
 
 // Initialize an FmtState by calling fmt_init() with a va_list (the varargs must
-// be terminated by the sentinel FMT_ARG_END).
+// be terminated by the sentinel FMT_ARG_END). In compact mode the varargs are
+// instead a single pointer to an array of FmtArgs ending with FMT_ARG_END; use
+// FMT_VA_ARGS to get either right.
 //
 // Then, fmt_chunk() can fill a buffer with more output. It returns false
 // when there's no more output to produce, and returns the amount it wrote in
@@ -182,15 +269,16 @@ void fmt_init(FmtState *state, const char *fmt, va_list va);
 bool fmt_chunk(FmtState *state, char *buf, size_t size);
 void fmt_reset(FmtState *fmt);
 
-// Utilities:
+// Utilities. The varargs of the *_va functions are what FMT_VA_ARGS passes
+// after the format string, which depends on FMT_COMPACT.
 int fmt_sn_va(char *buf, size_t size, const char *fmt, ...);
 int fmt_fprint_va(FILE *file, const char *fmt, ...);
 
 #define fmt_sn(buf, size, fmt, ...) \
-  fmt_sn_va((buf), (size), (fmt), FMT_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END)
+  fmt_sn_va((buf), (size), FMT_VA_ARGS(fmt, ##__VA_ARGS__))
 
 #define fmt_fprint(file, fmt, ...) \
-  fmt_fprint_va((file), (fmt), FMT_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END)
+  fmt_fprint_va((file), FMT_VA_ARGS(fmt, ##__VA_ARGS__))
 
 #define fmt_print(fmt, ...) \
   fmt_fprint(stdout, (fmt), ##__VA_ARGS__)
@@ -199,6 +287,88 @@ int fmt_fprint_va(FILE *file, const char *fmt, ...);
 
 // TODO: Put the above in some sort of UTILS #if.
 
+// Scanning:
+// fmt_scan() is the inverse of fmt_sn(): it matches input against the same
+// format strings, and stores the values it finds through pointer arguments.
+//   int x; uint8_t b; FmtStr name;
+//   int n = fmt_scan(line, line_size, "{} {:x} {}\n", &x, &b, &name);
+// It returns the number of arguments it stored, stopping at the first thing
+// that doesn't match.
+// * Text outside of {} has to match exactly ({{ matches '{'). Whitespace isn't
+//   skipped.
+// * Integers are decimal, or x (hexadecimal, either case), b (binary) or
+//   c (a UTF-8 character). Signed types accept a leading '-' or '+'.
+// * A FmtStr is set to point at the input rather than copying it. It extends
+//   up to the next occurrence of the character that follows the {} in the
+//   format (or to the end of the input).
+// * bool matches true or false, char matches any byte, and void * matches
+//   (nil) or 0x followed by hexadecimal.
+// * The size in a format spec is the maximum number of bytes to read (the
+//   exact number, for a FmtStr).
+// * Custom types: if you #define FMT_CUSTOM_SCAN 1, define
+//     bool fmt_custom_scan(FmtArg arg, FmtSpec spec, void *userdata,
+//                          const char *input, size_t size, size_t *consumed);
+//   arg.data points to the destination. If it can parse a value at the start
+//   of input, it should store it, set *consumed, and return true.
+//
+// To scan input that arrives in pieces, use FmtScanState:
+//   FmtScanState state;
+//   fmt_scan_init(&state, fmt, va);
+//   while (fmt_scan_chunk(&state, buf, buf_size, at_eof) == FmtScanMore) {
+//     // state.size bytes were used. Keep the rest of buf, and add more
+//     // input after it.
+//   }
+// FmtScanMore means a value (or the literal text) ran into the end of the
+// input and might continue; pass last = true when there's no more input.
+// FmtStrs point into the buffers you passed in, so they're valid as long as
+// those are.
+typedef struct FmtStr {
+  const char *data;
+  size_t size;
+} FmtStr;
+
+#define fmt_str(data, size) ((FmtStr){(data), (size)})
+
+typedef enum FmtScanStatus {
+  FmtScanDone,
+  FmtScanMore,
+  FmtScanMismatch,
+} FmtScanStatus;
+
+typedef struct FmtScanState {
+#if FMT_COMPACT
+  const FmtArg *args;
+#else
+  FmtArg args[FMT_MAX_ARGS];
+#endif
+  int arg_count;
+
+  const char *fmt_at_init;
+  const char *fmt;
+  void *userdata;
+
+  size_t size;
+
+  int next_arg_ix;
+  int scanned_count;
+} FmtScanState;
+
+void fmt_scan_init(FmtScanState *state, const char *fmt, va_list va);
+FmtScanStatus fmt_scan_chunk(FmtScanState *state,
+                             const char *input, size_t size, bool last);
+
+// Like fmt_sn_va(), the varargs are FMT_SCAN_VA_ARGS's, which depend on
+// FMT_COMPACT.
+int fmt_scan_va(const char *input, size_t size, const char *fmt, ...);
+
+#define fmt_scan(input, size, fmt, ...) \
+  fmt_scan_va((input), (size), FMT_SCAN_VA_ARGS(fmt, ##__VA_ARGS__))
+
+#if defined FMT_CUSTOM_SCAN && FMT_CUSTOM_SCAN
+bool fmt_custom_scan(FmtArg arg, FmtSpec spec, void *userdata,
+                     const char *input, size_t size, size_t *consumed);
+#endif
+
 
 #if !defined FMT_CUSTOM_TYPES
   #define FMT_CUSTOM_TYPES(_)
@@ -226,6 +396,10 @@ enum {
 
   FmtArgCharPtr,
   FmtArgVoidPtr,
+
+  FmtArgBytes,
+  FmtArgArray,
+  FmtArgStr,
 };
 
 
@@ -256,6 +430,42 @@ enum {
           FMT_9, FMT_8, FMT_7, FMT_6, FMT_5, \
           FMT_4, FMT_3, FMT_2, FMT_1, FMT_0)(__VA_ARGS__)
 
+// The same, for fmt_scan(): x is a pointer to the destination.
+#define FMT_SCAN_ARG(x) ((FmtArg){(x), FMT_MAKE_FMTTYPE(*(x))})
+
+#define FMT_SCAN_0(x)
+#define FMT_SCAN_1(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_0(__VA_ARGS__)
+#define FMT_SCAN_2(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_1(__VA_ARGS__)
+#define FMT_SCAN_3(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_2(__VA_ARGS__)
+#define FMT_SCAN_4(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_3(__VA_ARGS__)
+#define FMT_SCAN_5(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_4(__VA_ARGS__)
+#define FMT_SCAN_6(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_5(__VA_ARGS__)
+#define FMT_SCAN_7(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_6(__VA_ARGS__)
+#define FMT_SCAN_8(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_7(__VA_ARGS__)
+#define FMT_SCAN_9(x, ...) FMT_SCAN_ARG(x), FMT_SCAN_8(__VA_ARGS__)
+
+#define FMT_SCAN_ARGS(unused, ...) \
+  FMT_NTH(unused, ##__VA_ARGS__, \
+          FMT_SCAN_9, FMT_SCAN_8, FMT_SCAN_7, FMT_SCAN_6, FMT_SCAN_5, \
+          FMT_SCAN_4, FMT_SCAN_3, FMT_SCAN_2, FMT_SCAN_1, \
+          FMT_SCAN_0)(__VA_ARGS__)
+
+// The format string and then the varargs for fmt_init() and fmt_scan_init():
+// either the arguments themselves, or a pointer to an array of them in compact
+// mode. Both end with FMT_ARG_END. fmt is a named parameter so that callers
+// can pass no arguments with ##__VA_ARGS__, even in strict ISO C.
+#if FMT_COMPACT
+  #define FMT_VA_ARGS(fmt, ...) \
+    (fmt), ((const FmtArg[]){FMT_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END})
+  #define FMT_SCAN_VA_ARGS(fmt, ...) \
+    (fmt), ((const FmtArg[]){FMT_SCAN_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END})
+#else
+  #define FMT_VA_ARGS(fmt, ...) \
+    (fmt), FMT_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END
+  #define FMT_SCAN_VA_ARGS(fmt, ...) \
+    (fmt), FMT_SCAN_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END
+#endif
+
 #define FMT__GENERIC_CASE(type, val) type: val,
 
 // TODO: uint64_t and unsigned long long might both be unsigned 64-bit integers
@@ -275,6 +485,9 @@ enum {
   \
   char *: FmtArgCharPtr, \
   void *: FmtArgVoidPtr, \
+  FmtBytes: FmtArgBytes, \
+  FmtArray: FmtArgArray, \
+  FmtStr: FmtArgStr, \
   FMT_CUSTOM_TYPES(FMT__GENERIC_CASE) \
   default: FmtArgUnknown))
 
@@ -287,6 +500,14 @@ enum {
 #include <ctype.h>
 #include <string.h>
 
+#if defined __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#if !defined FMT_DISPLAY_WIDTH
+  #define FMT_DISPLAY_WIDTH 0
+#endif
+
 #if FMT__DEFAULT_CUSTOM_ARG
   bool fmt_custom_arg(FmtArg arg, FmtSpec spec,
                       void *userdata,
@@ -299,52 +520,61 @@ enum {
   }
 #endif
 
-static
-int show_S64_dec(char *buf, int64_t n) {
-  if (n == 0) {
-    buf[0] = '0';
-    return 1;
+#if !defined FMT_CUSTOM_SCAN || !FMT_CUSTOM_SCAN
+  static
+  bool fmt_custom_scan(FmtArg arg, FmtSpec spec, void *userdata,
+                       const char *input, size_t size, size_t *consumed) {
+    (void) arg;
+    (void) spec;
+    (void) userdata;
+    (void) input;
+    (void) size;
+    (void) consumed;
+    return false;
   }
+#endif
 
-  int len = 0;
-  for (int64_t m = n; m != 0; m /= 10) len++;
+static const char fmt__digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
 
-  bool negative = n < 0;
-  if (negative) {
-    buf[0] = '-';
-    len++;
+// Two digits at a time.
+static
+int show_U64_dec(char *buf, uint64_t n) {
+  int len = 1;
+  for (uint64_t m = n; m >= 10; m /= 10) len++;
+
+  char *at = buf + len;
+  while (n >= 100) {
+    at -= 2;
+    memcpy(at, &fmt__digit_pairs[2 * (n % 100)], 2);
+    n /= 100;
   }
-
-  int index = len - 1;
-  for (int64_t m = n; m != 0; m /= 10) {
-    char digit = m % 10;
-    buf[index] = (negative ? -digit : digit) + '0';
-    index--;
+  if (n >= 10) {
+    at -= 2;
+    memcpy(at, &fmt__digit_pairs[2 * n], 2);
+  } else {
+    *--at = '0' + n;
   }
 
   return len;
 }
 
 static
-int show_U64_dec(char *buf, uint64_t n) {
-  if (n == 0) {
-    buf[0] = '0';
-    return 1;
-  }
-  int len = 0;
-  for (uint64_t m = n; m != 0; m /= 10) len++;
-
-  int index = len - 1;
-  for (uint64_t m = n; m != 0; m /= 10) {
-    buf[index] = m % 10 + '0';
-    index--;
+int show_S64_dec(char *buf, int64_t n) {
+  if (n < 0) {
+    buf[0] = '-';
+    return 1 + show_U64_dec(buf + 1, -(uint64_t)n);
   }
-
-  return len;
+  return show_U64_dec(buf, n);
 }
 
+static const char fmt__hex_digits[] = "0123456789abcdef";
+static const char fmt__hex_digits_upper[] = "0123456789ABCDEF";
+
 static
-int show_U64_hex(char *buf, uint64_t n) {
+int show_U64_hex_digits(char *buf, uint64_t n, const char *digits) {
   if (n == 0) {
     buf[0] = '0';
     return 1;
@@ -353,13 +583,18 @@ int show_U64_hex(char *buf, uint64_t n) {
   for (uint64_t m = n; m != 0; m /= 16) len++;
   int index = len - 1;
   for (uint64_t m = n; m != 0; m /= 16) {
-    buf[index] = "0123456789abcdef"[m % 16];
+    buf[index] = digits[m % 16];
     index--;
   }
 
   return len;
 }
 
+static
+int show_U64_hex(char *buf, uint64_t n) {
+  return show_U64_hex_digits(buf, n, fmt__hex_digits);
+}
+
 static
 int show_U64_bin(char *buf, uint64_t n) {
   if (n == 0) {
@@ -377,13 +612,439 @@ int show_U64_bin(char *buf, uint64_t n) {
   return len;
 }
 
+// Shows c as a UTF-8 character, or as a raw byte if it came from a
+// char-sized type.
+static
+int show_char(char *buf, int64_t c, FmtArgType type) {
+  if (type == FmtArgChar || type == FmtArgS8 || type == FmtArgU8) {
+    buf[0] = (char)c;
+    return 1;
+  }
+  if (c < 0 || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+    c = 0xfffd; // Replacement character.
+  }
+  if (c < 0x80) {
+    buf[0] = c;
+    return 1;
+  }
+  if (c < 0x800) {
+    buf[0] = 0xc0 | (c >> 6);
+    buf[1] = 0x80 | (c & 0x3f);
+    return 2;
+  }
+  if (c < 0x10000) {
+    buf[0] = 0xe0 | (c >> 12);
+    buf[1] = 0x80 | ((c >> 6) & 0x3f);
+    buf[2] = 0x80 | (c & 0x3f);
+    return 3;
+  }
+  buf[0] = 0xf0 | (c >> 18);
+  buf[1] = 0x80 | ((c >> 12) & 0x3f);
+  buf[2] = 0x80 | ((c >> 6) & 0x3f);
+  buf[3] = 0x80 | (c & 0x3f);
+  return 4;
+}
+
+#if FMT_DISPLAY_WIDTH
+// Whether a code point takes up two columns. These are the wide ranges from
+// Markus Kuhn's wcwidth(), plus emoji.
+static
+bool fmt__is_wide(uint32_t c) {
+  return c >= 0x1100 &&
+    (c <= 0x115f ||
+     c == 0x2329 || c == 0x232a ||
+     (c >= 0x2e80 && c <= 0xa4cf && c != 0x303f) ||
+     (c >= 0xac00 && c <= 0xd7a3) ||
+     (c >= 0xf900 && c <= 0xfaff) ||
+     (c >= 0xfe10 && c <= 0xfe19) ||
+     (c >= 0xfe30 && c <= 0xfe6f) ||
+     (c >= 0xff00 && c <= 0xff60) ||
+     (c >= 0xffe0 && c <= 0xffe6) ||
+     (c >= 0x1f300 && c <= 0x1f64f) ||
+     (c >= 0x1f900 && c <= 0x1f9ff) ||
+     (c >= 0x20000 && c <= 0x2fffd) ||
+     (c >= 0x30000 && c <= 0x3fffd));
+}
+#endif
+
+// The number of code points (or columns, with FMT_DISPLAY_WIDTH) in UTF-8
+// text. ASCII is counted 16 bytes at a time.
+static
+size_t fmt__text_width(const char *text, size_t size) {
+  size_t width = 0;
+  size_t i = 0;
+  while (i < size) {
+#if defined __SSE2__
+    for (; i + 16 <= size; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        width += 16;
+        continue;
+      }
+    #if FMT_DISPLAY_WIDTH
+      // Decode the next character below.
+      break;
+    #else
+      // Everything but continuation bytes (0x80 to 0xbf, which are less than
+      // -64 as signed bytes) starts a code point.
+      const __m128i continuation = _mm_set1_epi8(-65);
+      int starts = _mm_movemask_epi8(_mm_cmpgt_epi8(v, continuation));
+      width += __builtin_popcount(starts);
+    #endif
+    }
+    if (i == size) break;
+#endif
+    uint8_t b = text[i++];
+    if ((b & 0xc0) == 0x80) continue;
+    width++;
+#if FMT_DISPLAY_WIDTH
+    // Wide characters take at least three bytes.
+    if (b >= 0xe0) {
+      uint32_t c = b & (b >= 0xf0 ? 0x07 : 0x0f);
+      for (int k = b >= 0xf0 ? 3 : 2;
+           k > 0 && i < size && (text[i] & 0xc0) == 0x80;
+           k--, i++) {
+        c = (c << 6) | (text[i] & 0x3f);
+      }
+      if (fmt__is_wide(c)) width++;
+    }
+#endif
+  }
+  return width;
+}
+
+#if FMT_SHOW_BUF_MAX < 64
+// Binary numbers that don't fit in text_buf are streamed from a copy of the
+// number at the start of text_buf.
+static
+size_t fmt__stream_bin(FmtFormatOutput *format_output, char *buf, size_t size) {
+  uint64_t n;
+  memcpy(&n, format_output->stream_arg, sizeof n);
+  size_t len = 1;
+  for (uint64_t m = n; m > 1; m >>= 1) len++;
+  size_t pos = format_output->stream_pos;
+  if (!buf) return len - pos;
+
+  size_t actual_size = len - pos < size ? len - pos : size;
+  for (size_t i = 0; i < actual_size; i++) {
+    buf[i] = '0' + ((n >> (len - 1 - pos - i)) & 1);
+  }
+  format_output->stream_pos += actual_size;
+  if (format_output->stream_pos == len) format_output->stream = 0;
+  return actual_size;
+}
+#endif
+
+static
+void fmt__format_bin(FmtFormatOutput *format_output, uint64_t n) {
+#if FMT_SHOW_BUF_MAX < 64
+  if (n >> (FMT_SHOW_BUF_MAX - 1) >> 1) {
+    memcpy(format_output->text, &n, sizeof n);
+    format_output->text_size = 0;
+    format_output->stream = fmt__stream_bin;
+    format_output->stream_arg = format_output->text;
+    format_output->stream_pos = 0;
+    return;
+  }
+#endif
+  format_output->text_size = show_U64_bin(format_output->text, n);
+}
+
+static inline
+bool fmt__needs_escape(unsigned char c, char mode) {
+  return c < 0x20 || c == '"' || c == '\\' || (mode == 'q' && c == 0x7f);
+}
+
+// Returns the index of the first byte in s[0..n) that needs escaping, or n.
+// Most text doesn't need escaping, so check a block at a time.
+static
+size_t fmt__escape_scan(const char *s, size_t n, char mode) {
+  size_t i = 0;
+#if defined __SSE2__
+  const __m128i ctl = _mm_set1_epi8(0x1f);
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i del = _mm_set1_epi8(mode == 'q' ? 0x7f : '"');
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    // Unsigned v <= 0x1f.
+    __m128i hit = _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl);
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, quote));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, backslash));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, del));
+    int mask = _mm_movemask_epi8(hit);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#else
+  // Same thing, 8 bytes at a time. This only tells us whether a word has a
+  // byte that needs escaping; the loop below finds it.
+  const uint64_t ones = UINT64_C(0x0101010101010101);
+  const uint64_t highs = ones * 0x80;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    uint64_t q = w ^ (ones * '"');
+    uint64_t b = w ^ (ones * '\\');
+    uint64_t d = w ^ (ones * (mode == 'q' ? 0x7f : '"'));
+    uint64_t hit = ((w - ones * 0x20) & ~w) |
+                   ((q - ones) & ~q) |
+                   ((b - ones) & ~b) |
+                   ((d - ones) & ~d);
+    if (hit & highs) break;
+  }
+#endif
+  for (; i < n; i++) {
+    if (fmt__needs_escape(s[i], mode)) break;
+  }
+  return i;
+}
+
+// Writes the escape sequence for c (which needs escaping) into buf, which
+// must have room for 6 bytes. Returns the length.
+static
+int fmt__escape_char(char *buf, unsigned char c, char mode) {
+  char short_form = 0;
+  switch (c) {
+  case '"': short_form = '"'; break;
+  case '\\': short_form = '\\'; break;
+  case '\b': short_form = 'b'; break;
+  case '\f': short_form = 'f'; break;
+  case '\n': short_form = 'n'; break;
+  case '\r': short_form = 'r'; break;
+  case '\t': short_form = 't'; break;
+  case '\a': if (mode == 'q') short_form = 'a'; break;
+  case '\v': if (mode == 'q') short_form = 'v'; break;
+  }
+  buf[0] = '\\';
+  if (short_form) {
+    buf[1] = short_form;
+    return 2;
+  }
+  if (mode == 'j') {
+    memcpy(buf + 1, "u00", 3);
+    buf[4] = fmt__hex_digits[c >> 4];
+    buf[5] = fmt__hex_digits[c & 15];
+    return 6;
+  }
+  // Always use three octal digits, since \x doesn't know where to stop.
+  buf[1] = '0' + (c >> 6);
+  buf[2] = '0' + ((c >> 3) & 7);
+  buf[3] = '0' + (c & 7);
+  return 4;
+}
+
+static
+size_t fmt__escaped_size(const char *text, size_t size, char mode) {
+  size_t result = 0;
+  char seq[6];
+  while (size > 0) {
+    size_t run = fmt__escape_scan(text, size, mode);
+    result += run;
+    text += run;
+    size -= run;
+    if (size > 0) {
+      result += fmt__escape_char(seq, *text, mode);
+      text++;
+      size--;
+    }
+  }
+  return result;
+}
+
+// Writes up to raw_size bytes of format_output->text into cur, escaping it if
+// necessary, and advances the text. Returns the number of bytes written, and
+// stores the number of bytes of text used up in *consumed.
+static
+size_t fmt__copy_text(FmtFormatOutput *format_output,
+                      char *cur, size_t remaining,
+                      size_t raw_size, size_t *consumed) {
+  const char *text = format_output->text;
+  size_t written = 0;
+  size_t used = 0;
+
+  if (!format_output->escape) {
+    used = written = raw_size < remaining ? raw_size : remaining;
+    memcpy(cur, text, written);
+  } else {
+    char mode = format_output->escape;
+    while (used < raw_size && written < remaining) {
+      size_t run = fmt__escape_scan(text + used, raw_size - used, mode);
+      if (run > 0) {
+        if (run > remaining - written) run = remaining - written;
+        memcpy(cur + written, text + used, run);
+        written += run;
+        used += run;
+        continue;
+      }
+      // An escape sequence might not fit in the rest of the buffer, so it
+      // can be split across calls to fmt_chunk().
+      char seq[6];
+      size_t seq_size = fmt__escape_char(seq, text[used], mode);
+      size_t seq_done = format_output->escape_partial;
+      size_t actual_size = seq_size - seq_done;
+      if (actual_size > remaining - written) actual_size = remaining - written;
+      memcpy(cur + written, seq + seq_done, actual_size);
+      written += actual_size;
+      seq_done += actual_size;
+      if (seq_done == seq_size) {
+        format_output->escape_partial = 0;
+        used++;
+      } else {
+        format_output->escape_partial = seq_done;
+      }
+    }
+  }
+
+  format_output->text += used;
+  format_output->text_size -= used;
+  *consumed = used;
+  return written;
+}
+
+// Writes n bytes from in as 2 * n hexadecimal digits.
+static
+void fmt__hex_encode(char *out, const uint8_t *in, size_t n, bool upper) {
+  const char *digits = upper ? fmt__hex_digits_upper : fmt__hex_digits;
+  size_t i = 0;
+#if defined __SSE2__
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i letter = _mm_set1_epi8((upper ? 'A' : 'a') - '0' - 10);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    __m128i lo = _mm_and_si128(v, nibble);
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+                      _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+                      _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+    _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+#endif
+  for (; i < n; i++) {
+    out[2 * i] = digits[in[i] >> 4];
+    out[2 * i + 1] = digits[in[i] & 15];
+  }
+}
+
+// Stream for FmtBytes with :x or :X. stream_pos counts output bytes, so a
+// byte can be split across buffers.
+static
+size_t fmt__stream_hex(FmtFormatOutput *format_output, char *buf, size_t size) {
+  const FmtBytes *bytes = format_output->stream_arg;
+  const uint8_t *data = bytes->data;
+  size_t total = 2 * bytes->size;
+  size_t pos = format_output->stream_pos;
+  if (!buf) return total - pos;
+
+  bool upper = format_output->stream_spec.format == 'X';
+  const char *digits = upper ? fmt__hex_digits_upper : fmt__hex_digits;
+  size_t end = total - pos < size ? total : pos + size;
+  char *cur = buf;
+  if (pos % 2 == 1 && pos < end) {
+    *cur++ = digits[data[pos / 2] & 15];
+    pos++;
+  }
+  size_t whole_bytes = (end - pos) / 2;
+  fmt__hex_encode(cur, data + pos / 2, whole_bytes, upper);
+  cur += 2 * whole_bytes;
+  pos += 2 * whole_bytes;
+  if (pos < end) {
+    *cur++ = digits[data[pos / 2] >> 4];
+    pos++;
+  }
+
+  format_output->stream_pos = pos;
+  if (pos == total) format_output->stream = 0;
+  return cur - buf;
+}
+
+enum {
+  // "00000000  00 01 02 03 04 05 06 07  08 09 0a 0b 0c 0d 0e 0f  |0123456789abcdef|\n"
+  FMT__HEXDUMP_LINE_SIZE = 79,
+  // The same, without the characters after the '|'.
+  FMT__HEXDUMP_PREFIX_SIZE = 61,
+};
+
+// Writes the hexdump line for the (up to) 16 bytes starting at offset, and
+// returns its size.
+static
+size_t fmt__hexdump_line(char *line, const uint8_t *data, size_t size,
+                         size_t offset) {
+  size_t count = size - offset < 16 ? size - offset : 16;
+  char hex[32];
+  fmt__hex_encode(hex, data + offset, count, false);
+
+  size_t shown_offset = offset;
+  for (int i = 7; i >= 0; i--) {
+    line[i] = fmt__hex_digits[shown_offset & 15];
+    shown_offset >>= 4;
+  }
+  memset(line + 8, ' ', FMT__HEXDUMP_PREFIX_SIZE - 1 - 8);
+  for (size_t i = 0; i < count; i++) {
+    char *at = line + 10 + 3 * i + (i >= 8);
+    at[0] = hex[2 * i];
+    at[1] = hex[2 * i + 1];
+  }
+  char *ascii = line + FMT__HEXDUMP_PREFIX_SIZE - 1;
+  *ascii++ = '|';
+  for (size_t i = 0; i < count; i++) {
+    uint8_t c = data[offset + i];
+    *ascii++ = c >= 0x20 && c < 0x7f ? c : '.';
+  }
+  *ascii++ = '|';
+  *ascii++ = '\n';
+  return ascii - line;
+}
+
+// Stream for FmtBytes with :h. Every line but the last is the same size, so
+// stream_pos (in output bytes) tells us which line we're in.
+static
+size_t fmt__stream_hexdump(FmtFormatOutput *format_output,
+                           char *buf, size_t size) {
+  const FmtBytes *bytes = format_output->stream_arg;
+  const uint8_t *data = bytes->data;
+  size_t full_lines = bytes->size / 16;
+  size_t rest = bytes->size % 16;
+  size_t total = full_lines * FMT__HEXDUMP_LINE_SIZE +
+                 (rest ? FMT__HEXDUMP_PREFIX_SIZE + rest + 2 : 0);
+  if (!buf) return total - format_output->stream_pos;
+
+  size_t written = 0;
+  while (written < size && format_output->stream_pos < total) {
+    size_t line_ix = format_output->stream_pos / FMT__HEXDUMP_LINE_SIZE;
+    size_t col = format_output->stream_pos % FMT__HEXDUMP_LINE_SIZE;
+    char line[FMT__HEXDUMP_LINE_SIZE];
+    // Whole lines go straight into buf.
+    bool direct = col == 0 && size - written >= FMT__HEXDUMP_LINE_SIZE;
+    char *dest = direct ? buf + written : line;
+    size_t line_size = fmt__hexdump_line(dest, data, bytes->size, 16 * line_ix);
+    size_t actual_size = line_size - col;
+    if (actual_size > size - written) actual_size = size - written;
+    if (!direct) memcpy(buf + written, line + col, actual_size);
+    written += actual_size;
+    format_output->stream_pos += actual_size;
+  }
+
+  if (format_output->stream_pos == total) format_output->stream = 0;
+  return written;
+}
 
 void fmt_init(FmtState *state, const char *fmt, va_list va) {
   int arg_count;
+#if FMT_COMPACT
+  state->args = va_arg(va, const FmtArg *);
+  for (arg_count = 0; arg_count < FMT_MAX_ARGS; arg_count++) {
+    if (!state->args[arg_count].data) break;
+  }
+#else
   for (arg_count = 0; arg_count < FMT_MAX_ARGS; arg_count++) {
     state->args[arg_count] = va_arg(va, FmtArg);
     if (!state->args[arg_count].data) break;
   }
+#endif
 
   state->arg_count = arg_count;
   state->fmt_at_init = fmt;
@@ -452,10 +1113,15 @@ bool fmt_parse_argspec(const char **fmt_ptr,
           fmt++;
         }
       }
-      if (*fmt == 'x' || *fmt == 'b' || *fmt == 'c' || *fmt == 'p') {
+      if (*fmt == 'x' || *fmt == 'X' || *fmt == 'b' || *fmt == 'c' ||
+          *fmt == 'h' || *fmt == 'p') {
         spec.format = *fmt;
         fmt++;
       }
+      if (*fmt == 'j' || *fmt == 'q') {
+        spec.escape = *fmt;
+        fmt++;
+      }
       break;
     }
     case '}': done = true; fmt++; break;
@@ -494,6 +1160,10 @@ bool fmt_parse_argspec(const char **fmt_ptr,
   return !invalid;
 }
 
+static
+size_t fmt__stream_array(FmtFormatOutput *format_output,
+                         char *buf, size_t size);
+
 static inline
 void fmt_format_arg(FmtArg arg, FmtSpec spec,
                     void *userdata, FmtFormatOutput *format_output) {
@@ -536,13 +1206,15 @@ void fmt_format_arg(FmtArg arg, FmtSpec spec,
                                              *(char    *)arg.data;
       if (spec.format == 0) {
         format_output->text_size = show_S64_dec(format_output->text, val);
-      } else if (spec.format == 'x') {
+      } else if (spec.format == 'x' || spec.format == 'h') {
         format_output->text_size = show_U64_hex(format_output->text, val);
+      } else if (spec.format == 'X') {
+        format_output->text_size = show_U64_hex_digits(format_output->text, val,
+                                                       fmt__hex_digits_upper);
       } else if (spec.format == 'b') {
-        format_output->text_size = show_U64_bin(format_output->text, val);
+        fmt__format_bin(format_output, val);
       } else if (spec.format == 'c') {
-        *format_output->text = (char)val;
-        format_output->text_size = 1;
+        format_output->text_size = show_char(format_output->text, val, arg.type);
       } else assert(0);
       break;
     }
@@ -551,18 +1223,20 @@ void fmt_format_arg(FmtArg arg, FmtSpec spec,
     case (FMT__CHAR_IS_SIGNED ? FmtArgFirstBuiltin : FmtArgChar): {
       uint64_t val = arg.type == FmtArgU64 ? *(uint64_t *)arg.data :
                      arg.type == FmtArgU32 ? *(uint32_t *)arg.data :
-                     arg.type == FmtArgU16 ? *(uint16_t *)arg.data :
-                     arg.type == FmtArgU8  ? *(uint8_t  *)arg.data :
-                                             *(char     *)arg.data;
+                     arg.type == FmtArgU16 ? (uint64_t)*(uint16_t *)arg.data :
+                     arg.type == FmtArgU8  ? (uint64_t)*(uint8_t  *)arg.data :
+                                             (uint64_t)*(char     *)arg.data;
       if (spec.format == 0) {
         format_output->text_size = show_U64_dec(format_output->text, val);
-      } else if (spec.format == 'x') {
+      } else if (spec.format == 'x' || spec.format == 'h') {
         format_output->text_size = show_U64_hex(format_output->text, val);
+      } else if (spec.format == 'X') {
+        format_output->text_size = show_U64_hex_digits(format_output->text, val,
+                                                       fmt__hex_digits_upper);
       } else if (spec.format == 'b') {
-        format_output->text_size = show_U64_bin(format_output->text, val);
+        fmt__format_bin(format_output, val);
       } else if (spec.format == 'c') {
-        *format_output->text = (char)val;
-        format_output->text_size = 1;
+        format_output->text_size = show_char(format_output->text, val, arg.type);
       } else assert(0);
       break;
     }
@@ -573,6 +1247,32 @@ void fmt_format_arg(FmtArg arg, FmtSpec spec,
       format_output->text_size = strlen(format_output->text);
       break;
     }
+    case FmtArgBytes: {
+      format_output->stream = spec.format == 'h' ? fmt__stream_hexdump
+                                                 : fmt__stream_hex;
+      format_output->stream_arg = arg.data;
+      format_output->stream_pos = 0;
+      format_output->stream_spec = spec;
+      break;
+    }
+    case FmtArgArray: {
+      const FmtArray *array = arg.data;
+      format_output->stream = array->count > 0 ? fmt__stream_array : 0;
+      format_output->stream_arg = array;
+      format_output->stream_pos = 0;
+      format_output->stream_skip = 0;
+      format_output->stream_spec = spec;
+      format_output->stream_buf = format_output->text;
+      // The spec is for the elements, so don't pad the whole array.
+      format_output->pad_mode = FmtPadManual;
+      break;
+    }
+    case FmtArgStr: {
+      FmtStr str = *(FmtStr *)arg.data;
+      format_output->text = (char *)str.data;
+      format_output->text_size = str.size;
+      break;
+    }
     case FmtArgCharPtr: {
       // Use string directly.
       char *str = *(char **)arg.data;
@@ -591,6 +1291,8 @@ void fmt_format_arg(FmtArg arg, FmtSpec spec,
     }
   }
 
+  format_output->escape = spec.escape;
+
   bool calculate_padding = true;
   switch (format_output->pad_mode) {
   case FmtPadRight:
@@ -607,12 +1309,272 @@ void fmt_format_arg(FmtArg arg, FmtSpec spec,
   }
   if (calculate_padding) {
     assert(format_output->pad_size == 0);
-    if (format_output->text_size < spec.min_len) {
-      format_output->pad_size = spec.min_len - format_output->text_size;
+    size_t width = 0;
+    if (spec.min_len > 0) {
+      width = fmt__text_width(format_output->text, format_output->text_size);
+      if (format_output->escape) {
+        // Escape sequences are ASCII, and everything else is left alone.
+        width += fmt__escaped_size(format_output->text,
+                                   format_output->text_size,
+                                   format_output->escape) -
+                 format_output->text_size;
+      }
+      if (format_output->stream) {
+        width += format_output->stream(format_output, 0, 0);
+      }
+    }
+    if (width < spec.min_len) {
+      format_output->pad_size = spec.min_len - width;
     }
   }
 }
 
+// Writes as much of a formatted argument as fits into cur, and returns the
+// size written.
+static
+size_t fmt__write_output(FmtFormatOutput *output, char *cur, size_t remaining) {
+  size_t size_written = 0;
+  // Padding might be inserted in the middle of the text. So there are
+  // three pieces: text before pad_pos, padding, text after pad_pos
+  // Streamed text goes at the end, or before the padding if it's padded
+  // on the right.
+  assert(output->pad_pos <= output->text_size);
+  // This code is kind of a mess.
+  bool stream_first = output->pad_mode == FmtPadRight;
+
+  // Text before padding:
+  if (output->pad_pos > 0 && remaining > 0) {
+    size_t consumed;
+    size_t actual_size = fmt__copy_text(output, cur, remaining,
+                                        output->pad_pos, &consumed);
+    cur += actual_size;
+    remaining -= actual_size;
+    output->pad_pos -= consumed;
+    size_written += actual_size;
+  }
+  // Streamed text before padding:
+  if (output->stream && stream_first &&
+      output->pad_pos == 0 && remaining > 0) {
+    size_t actual_size = output->stream(output, cur, remaining);
+    cur += actual_size;
+    remaining -= actual_size;
+    size_written += actual_size;
+  }
+  // Padding:
+  if (output->pad_size > 0 && remaining > 0 &&
+      !(output->stream && stream_first)) {
+    assert(output->pad_pos == 0);
+    size_t actual_size = output->pad_size;
+    if (actual_size > remaining) actual_size = remaining;
+    memset(cur, output->pad_byte, actual_size);
+    cur += actual_size;
+    output->pad_size -= actual_size;
+    remaining -= actual_size;
+    size_written += actual_size;
+  }
+  // Text after padding:
+  if (output->text_size > 0 && remaining > 0) {
+    assert(output->pad_size == 0);
+    size_t consumed;
+    size_t actual_size = fmt__copy_text(output, cur, remaining,
+                                        output->text_size, &consumed);
+    cur += actual_size;
+    remaining -= actual_size;
+    size_written += actual_size;
+  }
+  // Streamed text after everything else:
+  if (output->stream && output->pad_size == 0 &&
+      output->text_size == 0 && remaining > 0) {
+    size_t actual_size = output->stream(output, cur, remaining);
+    cur += actual_size;
+    remaining -= actual_size;
+    size_written += actual_size;
+  }
+  return size_written;
+}
+
+// The size of the rest of a formatted argument.
+static
+size_t fmt__output_size(FmtFormatOutput *output) {
+  size_t text_size = output->text_size;
+  if (output->escape) {
+    text_size = fmt__escaped_size(output->text, text_size, output->escape) -
+                output->escape_partial;
+  }
+  if (output->stream) {
+    text_size += output->stream(output, 0, 0);
+  }
+  return output->pad_size + text_size;
+}
+
+static inline
+bool fmt__output_done(const FmtFormatOutput *output) {
+  return output->pad_size == 0 && output->text_size == 0 && !output->stream;
+}
+
+// Defines a function that writes count integers, each followed by a
+// separator, straight into the output, without going through FmtFormatOutput.
+#define FMT__DEFINE_SHOW_INTS(name, T, show) \
+  static \
+  char *name(char *cur, const void *data, size_t count, \
+             const char *sep, size_t sep_len) { \
+    const T *values = data; \
+    for (size_t i = 0; i < count; i++) { \
+      cur += show(cur, values[i]); \
+      memcpy(cur, sep, sep_len); \
+      cur += sep_len; \
+    } \
+    return cur; \
+  }
+
+FMT__DEFINE_SHOW_INTS(fmt__show_S64s, int64_t, show_S64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_S32s, int32_t, show_S64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_S16s, int16_t, show_S64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_S8s, int8_t, show_S64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_U64s, uint64_t, show_U64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_U32s, uint32_t, show_U64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_U16s, uint16_t, show_U64_dec)
+FMT__DEFINE_SHOW_INTS(fmt__show_U8s, uint8_t, show_U64_dec)
+
+#undef FMT__DEFINE_SHOW_INTS
+
+// Moves past the first skip bytes of a formatted argument, like writing them
+// somewhere and throwing them away. The byte streams count their output in
+// stream_pos, so they can skip ahead without producing what they skip.
+static
+void fmt__skip_output(FmtFormatOutput *output, size_t skip) {
+  char scratch[64];
+  while (skip > 0) {
+    bool stream_first = output->pad_mode == FmtPadRight;
+    bool stream_next = output->stream && output->pad_pos == 0 &&
+      (stream_first || (output->pad_size == 0 && output->text_size == 0));
+    bool seekable = output->stream == fmt__stream_hex ||
+#if FMT_SHOW_BUF_MAX < 64
+                    output->stream == fmt__stream_bin ||
+#endif
+                    output->stream == fmt__stream_hexdump;
+    if (stream_next && seekable) {
+      size_t rest = output->stream(output, 0, 0);
+      if (skip < rest) {
+        output->stream_pos += skip;
+        return;
+      }
+      output->stream = 0;
+      skip -= rest;
+      continue;
+    }
+    size_t n = skip < sizeof scratch ? skip : sizeof scratch;
+    skip -= fmt__write_output(output, scratch, n);
+  }
+}
+
+// Stream for FmtArray. Elements and separators are numbered pieces, and
+// stream_pos is even for an element and odd for a separator. When the buffer
+// runs out in the middle of a piece, the rest of it is handed back as text,
+// and stream_pos moves on to the next piece. Elements that stream their
+// output can't be handed back, so they're formatted again on the next call
+// and stream_skip is how much of them was already written.
+static
+size_t fmt__stream_array(FmtFormatOutput *format_output,
+                         char *buf, size_t size) {
+  const FmtArray *array = format_output->stream_arg;
+  FmtSpec spec = format_output->stream_spec;
+  const char *sep = spec.custom_start ? spec.custom_start : ", ";
+  size_t sep_len = spec.custom_start ? spec.custom_len : 2;
+  spec.custom_start = 0;
+  spec.custom_len = 0;
+
+  char *(*show_ints)(char *, const void *, size_t, const char *, size_t) = 0;
+  if (spec.format == 0 && spec.min_len == 0) {
+    switch (array->type) {
+    case FmtArgS64: show_ints = fmt__show_S64s; break;
+    case FmtArgS32: show_ints = fmt__show_S32s; break;
+    case FmtArgS16: show_ints = fmt__show_S16s; break;
+    case FmtArgS8:  show_ints = fmt__show_S8s; break;
+    case FmtArgU64: show_ints = fmt__show_U64s; break;
+    case FmtArgU32: show_ints = fmt__show_U32s; break;
+    case FmtArgU16: show_ints = fmt__show_U16s; break;
+    case FmtArgU8:  show_ints = fmt__show_U8s; break;
+    default: break;
+    }
+  }
+  // "-9223372036854775808" and a separator.
+  size_t max_int_size = 20 + sep_len;
+
+  size_t piece_count = 2 * array->count - 1;
+  size_t pos = format_output->stream_pos;
+  size_t skip = format_output->stream_skip;
+  char *cur = buf;
+  size_t total = 0;
+  while (pos < piece_count) {
+    // Integers with default formatting are written straight into buf while
+    // there's room for the longest possible ones. The last element isn't
+    // followed by a separator, so leave it for later.
+    if (buf && show_ints && pos % 2 == 0 && skip == 0) {
+      size_t ix = pos / 2;
+      size_t batch = (size - (cur - buf)) / max_int_size;
+      if (batch > array->count - 1 - ix) batch = array->count - 1 - ix;
+      if (batch > 0) {
+        cur = show_ints(cur, (const char *)array->data + ix * array->elem_size,
+                        batch, sep, sep_len);
+        pos += 2 * batch;
+        continue;
+      }
+    }
+
+    FmtFormatOutput piece = {0};
+    if (pos % 2 == 1) {
+      piece.text = (char *)sep;
+      piece.text_size = sep_len;
+    } else {
+      FmtArg arg = {
+        (char *)array->data + pos / 2 * array->elem_size, array->type
+      };
+      piece.text = format_output->stream_buf;
+      piece.pad_byte = spec.pad_byte;
+      piece.pad_mode = spec.pad_mode;
+      fmt_format_arg(arg, spec, 0, &piece);
+    }
+
+    if (!buf) {
+      total += fmt__output_size(&piece) - skip;
+    } else {
+      fmt__skip_output(&piece, skip);
+      size_t actual_size = fmt__write_output(&piece, cur, size - (cur - buf));
+      cur += actual_size;
+      if (!fmt__output_done(&piece)) {
+        // Out of room.
+        if (piece.stream) {
+          format_output->stream_pos = pos;
+          format_output->stream_skip = skip + actual_size;
+        } else {
+          // pad_mode stays FmtPadManual: the rest of the text before
+          // pad_pos, the padding, and then the rest of the text.
+          format_output->text = piece.text;
+          format_output->text_size = piece.text_size;
+          format_output->pad_pos = piece.pad_pos;
+          format_output->pad_size = piece.pad_size;
+          format_output->pad_byte = piece.pad_byte;
+          format_output->escape = piece.escape;
+          format_output->escape_partial = piece.escape_partial;
+          format_output->stream_pos = pos + 1;
+          format_output->stream_skip = 0;
+          if (pos + 1 == piece_count) format_output->stream = 0;
+        }
+        return cur - buf;
+      }
+    }
+    skip = 0;
+    pos++;
+  }
+
+  if (!buf) return total;
+  format_output->stream_pos = pos;
+  format_output->stream_skip = 0;
+  format_output->stream = 0;
+  return cur - buf;
+}
+
 bool fmt_chunk(FmtState *state, char *buf, size_t buf_size) {
   if (state->action == FmtActionDone) {
     state->size = 0;
@@ -661,6 +1623,9 @@ bool fmt_chunk(FmtState *state, char *buf, size_t buf_size) {
         state->format_output.pad_size = 0;
         state->format_output.pad_byte = spec.pad_byte;
         state->format_output.pad_mode = spec.pad_mode;
+        state->format_output.escape = 0;
+        state->format_output.escape_partial = 0;
+        state->format_output.stream = 0;
 
         if (success) {
           int actual_arg_ix = requested_arg_ix;
@@ -684,56 +1649,20 @@ bool fmt_chunk(FmtState *state, char *buf, size_t buf_size) {
       }
       break;
     case FmtActionFormatting: {
+      FmtFormatOutput *output = &state->format_output;
       if (cur) {
-        size_t remaining = end - cur;
-        // Padding might be inserted in the middle of the text. So there are
-        // three pieces: text before pad_pos, padding, text after pad_pos
-        assert(state->format_output.pad_pos <= state->format_output.text_size);
-        // This code is kind of a mess.
-
-        // Text before padding:
-        if (state->format_output.pad_pos > 0 && remaining > 0) {
-          size_t actual_size = state->format_output.pad_pos;
-          if (actual_size > remaining) actual_size = remaining;
-          memcpy(cur, state->format_output.text, actual_size);
-          cur += actual_size;
-          remaining -= actual_size;
-          state->format_output.text += actual_size;
-          state->format_output.text_size -= actual_size;
-          state->format_output.pad_pos -= actual_size;
-          size_written += actual_size;
-        }
-        // Padding:
-        if (state->format_output.pad_size > 0 && remaining > 0) {
-          assert(state->format_output.pad_pos == 0);
-          size_t actual_size = state->format_output.pad_size;
-          if (actual_size > remaining) actual_size = remaining;
-          memset(cur, state->format_output.pad_byte, actual_size);
-          cur += actual_size;
-          state->format_output.pad_size -= actual_size;
-          remaining -= actual_size;
-          size_written += actual_size;
-        }
-        // Text after padding:
-        if (state->format_output.text_size > 0 && remaining > 0) {
-          assert(state->format_output.pad_size == 0);
-          size_t actual_size = state->format_output.text_size;
-          if (actual_size > remaining) actual_size = remaining;
-          memcpy(cur, state->format_output.text, actual_size);
-          cur += actual_size;
-          remaining -= actual_size;
-          state->format_output.text += actual_size;
-          state->format_output.text_size -= actual_size;
-          size_written += actual_size;
-        }
+        size_t actual_size = fmt__write_output(output, cur, end - cur);
+        cur += actual_size;
+        size_written += actual_size;
       } else {
         // Just counting.
-        size_written += state->format_output.pad_size + state->format_output.text_size;
-        state->format_output.pad_size = 0;
-        state->format_output.text_size = 0;
+        size_written += fmt__output_size(output);
+        output->pad_size = 0;
+        output->text_size = 0;
+        output->escape_partial = 0;
+        output->stream = 0;
       }
-      if (state->format_output.pad_size == 0 &&
-          state->format_output.text_size == 0) {
+      if (fmt__output_done(output)) {
         state->action = FmtActionParsing;
       } else {
         goto exit_loop;
@@ -784,6 +1713,10 @@ int fmt_sn_va(char *buf, size_t size, const char *fmt, ...) {
   return result_size;
 }
 
+#if !defined FMT_FPRINT_BUF_SIZE
+  #define FMT_FPRINT_BUF_SIZE 4096
+#endif
+
 int fmt_fprint_va(FILE *file, const char *fmt, ...) {
   FmtState state;
   va_list va;
@@ -794,16 +1727,364 @@ int fmt_fprint_va(FILE *file, const char *fmt, ...) {
   fmt_init(&state, fmt, va);
   va_end(va);
 
-  char buf[4096];
-  while (fmt_chunk(&state, buf, sizeof buf)) {
+#if FMT_COMPACT
+  // Use a buffer per thread instead of putting it on the stack. If a custom
+  // formatter calls fmt_fprint(), the nested call uses a small stack buffer.
+  static _Thread_local char sink[FMT_FPRINT_BUF_SIZE];
+  static _Thread_local bool sink_in_use;
+  char nested_buf[64];
+  bool use_sink = !sink_in_use;
+  char *buf = use_sink ? sink : nested_buf;
+  size_t buf_size = use_sink ? sizeof sink : sizeof nested_buf;
+  sink_in_use = true;
+#else
+  char buf[FMT_FPRINT_BUF_SIZE];
+  size_t buf_size = sizeof buf;
+#endif
+
+  while (fmt_chunk(&state, buf, buf_size)) {
     size_t written_size = fwrite(buf, 1, state.size, file);
     if (written_size < state.size) {
-      return -1;
+      total_written_size = -1;
+      break;
     }
     total_written_size += written_size;
   }
 
+#if FMT_COMPACT
+  if (use_sink) sink_in_use = false;
+#endif
   return total_written_size;
 }
 
+void fmt_scan_init(FmtScanState *state, const char *fmt, va_list va) {
+  int arg_count;
+#if FMT_COMPACT
+  state->args = va_arg(va, const FmtArg *);
+  for (arg_count = 0; arg_count < FMT_MAX_ARGS; arg_count++) {
+    if (!state->args[arg_count].data) break;
+  }
+#else
+  for (arg_count = 0; arg_count < FMT_MAX_ARGS; arg_count++) {
+    state->args[arg_count] = va_arg(va, FmtArg);
+    if (!state->args[arg_count].data) break;
+  }
+#endif
+
+  state->arg_count = arg_count;
+  state->fmt_at_init = fmt;
+  state->fmt = fmt;
+
+  state->userdata = 0;
+
+  state->size = 0;
+
+  state->next_arg_ix = 0;
+  state->scanned_count = 0;
+}
+
+// Digit parsing 8 bytes at a time. These work on little-endian loads.
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  #define FMT__SWAR_SCAN 1
+#else
+  #define FMT__SWAR_SCAN 0
+#endif
+
+static inline
+bool fmt__is_8_digits(uint64_t v) {
+  uint64_t high = v & UINT64_C(0xf0f0f0f0f0f0f0f0);
+  uint64_t carry = ((v + UINT64_C(0x0606060606060606)) &
+                    UINT64_C(0xf0f0f0f0f0f0f0f0)) >> 4;
+  return (high | carry) == UINT64_C(0x3333333333333333);
+}
+
+static inline
+uint32_t fmt__parse_8_digits(uint64_t v) {
+  v -= UINT64_C(0x3030303030303030);
+  v = v * 10 + (v >> 8);
+  v = ((v & UINT64_C(0x000000ff000000ff)) * (100 + (UINT64_C(1000000) << 32)) +
+       ((v >> 16) & UINT64_C(0x000000ff000000ff)) *
+       (1 + (UINT64_C(10000) << 32))) >> 32;
+  return (uint32_t)v;
+}
+
+// v holds 8 hex digits that have already been checked.
+static inline
+uint32_t fmt__parse_8_hex_digits(uint64_t v) {
+  const uint64_t ones = UINT64_C(0x0101010101010101);
+  // Letters have bit 6 set, and their low nibble is 9 less than their value.
+  v = (v & (ones * 0x0f)) + 9 * ((v >> 6) & ones);
+  // Combine neighbouring nibbles, then bytes, then 16-bit halves. The first
+  // digit is in the lowest byte.
+  v = ((v & UINT64_C(0x00ff00ff00ff00ff)) << 4) |
+      ((v >> 8) & UINT64_C(0x00ff00ff00ff00ff));
+  v = ((v & UINT64_C(0x0000ffff0000ffff)) << 8) |
+      ((v >> 16) & UINT64_C(0x0000ffff0000ffff));
+  v = ((v & UINT64_C(0xffffffff)) << 16) | (v >> 32);
+  return (uint32_t)v;
+}
+
+static inline
+int fmt__digit_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 99;
+}
+
+// Parses an unsigned number from the start of s, and returns how many bytes
+// it used (0 if there are no digits). Sets *overflow if it doesn't fit.
+static
+size_t fmt__scan_U64(const char *s, size_t size, int base,
+                     uint64_t *out, bool *overflow) {
+  uint64_t n = 0;
+  size_t i = 0;
+  *overflow = false;
+#if FMT__SWAR_SCAN
+  if (base == 10) {
+    for (; i + 8 <= size; i += 8) {
+      uint64_t v;
+      memcpy(&v, s + i, 8);
+      if (!fmt__is_8_digits(v)) break;
+      uint32_t chunk = fmt__parse_8_digits(v);
+      if (n > (UINT64_MAX - chunk) / 100000000) *overflow = true;
+      n = n * 100000000 + chunk;
+    }
+  } else if (base == 16) {
+    size_t digits = i;
+    while (digits < size && fmt__digit_value(s[digits]) < 16) digits++;
+    for (; i + 8 <= digits; i += 8) {
+      uint64_t v;
+      memcpy(&v, s + i, 8);
+      if (n >> 32) *overflow = true;
+      n = n << 32 | fmt__parse_8_hex_digits(v);
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    int digit = fmt__digit_value(s[i]);
+    if (digit >= base) break;
+    if (n > (UINT64_MAX - digit) / base) *overflow = true;
+    n = n * base + digit;
+  }
+  *out = n;
+  return i;
+}
+
+// Decodes one UTF-8 character, returning its size (0 if it's incomplete).
+static
+size_t fmt__scan_utf8(const char *s, size_t size, uint32_t *out) {
+  if (size == 0) return 0;
+  uint8_t b = s[0];
+  size_t len = b >= 0xf0 ? 4 : b >= 0xe0 ? 3 : b >= 0xc0 ? 2 : 1;
+  if (size < len) return 0;
+  uint32_t c = len == 1 ? b : b & (0x7f >> len);
+  for (size_t k = 1; k < len; k++) c = (c << 6) | (s[k] & 0x3f);
+  *out = c;
+  return len;
+}
+
+// Matches one argument at the start of input. delim is the character after
+// the argspec in the format string, or -1.
+static
+FmtScanStatus fmt__scan_arg(FmtArg arg, FmtSpec spec, void *userdata,
+                            const char *input, size_t size, bool last,
+                            int delim, size_t *consumed) {
+  // If a field runs into the end of the input, it might continue in the next
+  // chunk, unless it's limited to a fixed size.
+  bool limited = spec.min_len > 0 && spec.min_len <= size;
+  size_t field_size = limited ? spec.min_len : size;
+  #define FMT__MIGHT_CONTINUE(used) (!last && !limited && (used) == size)
+
+  switch (arg.type) {
+  case FmtArgS64: case FmtArgS32: case FmtArgS16: case FmtArgS8:
+  case FmtArgU64: case FmtArgU32: case FmtArgU16: case FmtArgU8: {
+    bool is_signed = arg.type == FmtArgS64 || arg.type == FmtArgS32 ||
+                     arg.type == FmtArgS16 || arg.type == FmtArgS8;
+    uint64_t n;
+    size_t used;
+    bool negative = false;
+    if (spec.format == 'c') {
+      uint32_t c;
+      used = fmt__scan_utf8(input, field_size, &c);
+      if (used == 0) return last || limited ? FmtScanMismatch : FmtScanMore;
+      n = c;
+    } else {
+      used = 0;
+      if (is_signed && field_size > 0 &&
+          (input[0] == '-' || input[0] == '+')) {
+        negative = input[0] == '-';
+        used++;
+      }
+      int base = spec.format == 'x' || spec.format == 'X' ? 16 :
+                 spec.format == 'b' ? 2 : 10;
+      bool overflow;
+      size_t digits = fmt__scan_U64(input + used, field_size - used, base,
+                                    &n, &overflow);
+      used += digits;
+      if (FMT__MIGHT_CONTINUE(used)) return FmtScanMore;
+      if (digits == 0 || overflow) return FmtScanMismatch;
+    }
+
+    #define FMT__SCAN_STORE(T, max) \
+      if (n > (uint64_t)(max) + negative) return FmtScanMismatch; \
+      *(T *)arg.data = negative ? (T)-n : (T)n;
+    switch (arg.type) {
+    case FmtArgS64: FMT__SCAN_STORE(int64_t, INT64_MAX); break;
+    case FmtArgS32: FMT__SCAN_STORE(int32_t, INT32_MAX); break;
+    case FmtArgS16: FMT__SCAN_STORE(int16_t, INT16_MAX); break;
+    case FmtArgS8:  FMT__SCAN_STORE(int8_t, INT8_MAX); break;
+    case FmtArgU64: FMT__SCAN_STORE(uint64_t, UINT64_MAX); break;
+    case FmtArgU32: FMT__SCAN_STORE(uint32_t, UINT32_MAX); break;
+    case FmtArgU16: FMT__SCAN_STORE(uint16_t, UINT16_MAX); break;
+    case FmtArgU8:  FMT__SCAN_STORE(uint8_t, UINT8_MAX); break;
+    }
+    #undef FMT__SCAN_STORE
+    *consumed = used;
+    return FmtScanDone;
+  }
+  case FmtArgChar:
+    if (size == 0) return last ? FmtScanMismatch : FmtScanMore;
+    *(char *)arg.data = input[0];
+    *consumed = 1;
+    return FmtScanDone;
+  case FmtArgBool: {
+    const char *words[] = {"false", "true"};
+    for (int i = 0; i < 2; i++) {
+      size_t len = strlen(words[i]);
+      size_t common = field_size < len ? field_size : len;
+      if (memcmp(input, words[i], common) != 0) continue;
+      if (common < len) return FMT__MIGHT_CONTINUE(common) ? FmtScanMore
+                                                           : FmtScanMismatch;
+      *(bool *)arg.data = i;
+      *consumed = len;
+      return FmtScanDone;
+    }
+    return FmtScanMismatch;
+  }
+  case FmtArgStr: {
+    size_t str_size;
+    if (spec.min_len > 0) {
+      if (!limited) return last ? FmtScanMismatch : FmtScanMore;
+      str_size = spec.min_len;
+    } else if (delim >= 0) {
+      const char *found = memchr(input, delim, size);
+      if (!found) return last ? FmtScanMismatch : FmtScanMore;
+      str_size = found - input;
+    } else {
+      if (!last) return FmtScanMore;
+      str_size = size;
+    }
+    *(FmtStr *)arg.data = (FmtStr){input, str_size};
+    *consumed = str_size;
+    return FmtScanDone;
+  }
+  case FmtArgVoidPtr: {
+    static const char nil[] = "(nil)";
+    size_t common = field_size < 5 ? field_size : 5;
+    if (common > 0 && memcmp(input, nil, common) == 0) {
+      if (common < 5) return FMT__MIGHT_CONTINUE(common) ? FmtScanMore
+                                                         : FmtScanMismatch;
+      *(void **)arg.data = 0;
+      *consumed = 5;
+      return FmtScanDone;
+    }
+    common = field_size < 2 ? field_size : 2;
+    if (memcmp(input, "0x", common) != 0) return FmtScanMismatch;
+    if (common < 2) return FMT__MIGHT_CONTINUE(common) ? FmtScanMore
+                                                       : FmtScanMismatch;
+    uint64_t n;
+    bool overflow;
+    size_t used = 2 + fmt__scan_U64(input + 2, field_size - 2, 16,
+                                    &n, &overflow);
+    if (FMT__MIGHT_CONTINUE(used)) return FmtScanMore;
+    if (used == 2 || overflow || n > UINTPTR_MAX) return FmtScanMismatch;
+    *(void **)arg.data = (void *)(uintptr_t)n;
+    *consumed = used;
+    return FmtScanDone;
+  }
+  default: {
+    size_t used = 0;
+    if (!fmt_custom_scan(arg, spec, userdata, input, field_size, &used)) {
+      return FmtScanMismatch;
+    }
+    if (FMT__MIGHT_CONTINUE(used)) return FmtScanMore;
+    *consumed = used;
+    return FmtScanDone;
+  }
+  }
+  #undef FMT__MIGHT_CONTINUE
+}
+
+FmtScanStatus fmt_scan_chunk(FmtScanState *state,
+                             const char *input, size_t size, bool last) {
+  const char *cur = input;
+  const char *end = input + size;
+  FmtScanStatus status = FmtScanDone;
+
+  while (*state->fmt != '\0') {
+    if (*state->fmt != '{' ||
+        (state->fmt[0] == '{' && state->fmt[1] == '{')) {
+      // Match a character.
+      if (cur == end) {
+        status = last ? FmtScanMismatch : FmtScanMore;
+        break;
+      }
+      if (*cur != *state->fmt) {
+        status = FmtScanMismatch;
+        break;
+      }
+      cur++;
+      if (*state->fmt == '{') state->fmt++;
+      state->fmt++;
+    } else {
+      // Parse arg. state->fmt stays at the '{' until it's matched, so we can
+      // try again with more input.
+      const char *fmt = state->fmt;
+      int requested_arg_ix;
+      FmtSpec spec;
+      if (!fmt_parse_argspec(&fmt, &requested_arg_ix, &spec)) {
+        status = FmtScanMismatch;
+        break;
+      }
+      int actual_arg_ix = requested_arg_ix;
+      if (actual_arg_ix == -1) actual_arg_ix = state->next_arg_ix;
+      if (actual_arg_ix >= state->arg_count) {
+        status = FmtScanMismatch;
+        break;
+      }
+
+      int delim = -1;
+      if (*fmt != '\0' && (fmt[0] != '{' || fmt[1] == '{')) {
+        delim = (unsigned char)*fmt;
+      }
+      size_t consumed = 0;
+      status = fmt__scan_arg(state->args[actual_arg_ix], spec,
+                             state->userdata, cur, end - cur, last,
+                             delim, &consumed);
+      if (status != FmtScanDone) break;
+
+      cur += consumed;
+      state->fmt = fmt;
+      if (requested_arg_ix == -1) state->next_arg_ix++;
+      state->scanned_count++;
+    }
+  }
+
+  state->size = cur - input;
+  return status;
+}
+
+int fmt_scan_va(const char *input, size_t size, const char *fmt, ...) {
+  FmtScanState state;
+  va_list va;
+
+  va_start(va, fmt);
+  fmt_scan_init(&state, fmt, va);
+  va_end(va);
+
+  fmt_scan_chunk(&state, input, size, true);
+  return state.scanned_count;
+}
+
 #endif // FMT_IMPL
@@ -20,6 +20,14 @@ typedef struct Point {
   _(float, FmtTypeFloat) \
   _(double, FmtTypeDouble)
 
+#define FMT_CUSTOM_SCAN 1
+
+// Build with -DFMT_COMPACT=1 to check compact mode.
+#if FMT_COMPACT
+// Formatting should fit in a few hundred bytes of stack.
+enum { FMT_CHECK_MAX_STATE_SIZE = 256 };
+#endif
+
 #define FMT_IMPL
 #include "fmt.h"
 
@@ -67,6 +75,24 @@ bool fmt_custom_arg(FmtArg arg, FmtSpec spec,
   return false;
 }
 
+bool fmt_custom_scan(FmtArg arg, FmtSpec spec, void *userdata,
+                     const char *input, size_t size, size_t *consumed) {
+  (void) spec;
+  (void) userdata;
+  if (arg.type == FmtTypePoint) {
+    const char *end = memchr(input, '}', size);
+    if (!end) return false;
+    struct Point p;
+    if (fmt_scan(input, end + 1 - input, "{{{},{}}", &p.x, &p.y) != 2) {
+      return false;
+    }
+    *(struct Point *)arg.data = p;
+    *consumed = end + 1 - input;
+    return true;
+  }
+  return false;
+}
+
 // malloc a nul-terminated string and print into it.
 char *fmt_malloc_va(const char *fmt, ...) {
   FmtState state;
@@ -90,8 +116,39 @@ char *fmt_malloc_va(const char *fmt, ...) {
   return mem;
 }
 
+void fmt_scan_init_args_va(FmtScanState *state, const char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  fmt_scan_init(state, fmt, va);
+  va_end(va);
+}
+
+#define fmt_scan_init_args(state, fmt, ...) \
+  fmt_scan_init_args_va((state), FMT_SCAN_VA_ARGS(fmt, ##__VA_ARGS__))
+
 #define fmt_malloc(fmt, ...) \
-  fmt_malloc_va((fmt), FMT_ARGS(unused, ##__VA_ARGS__) FMT_ARG_END)
+  fmt_malloc_va(FMT_VA_ARGS(fmt, ##__VA_ARGS__))
+
+// Print through a tiny buffer, to check that formatting resumes properly.
+int fmt_print_chunked_va(size_t chunk_size, const char *fmt, ...) {
+  FmtState state;
+  va_list va;
+  va_start(va, fmt);
+  fmt_init(&state, fmt, va);
+  va_end(va);
+
+  int total_written_size = 0;
+  char buf[16];
+  assert(chunk_size <= sizeof buf);
+  while (fmt_chunk(&state, buf, chunk_size)) {
+    fwrite(buf, 1, state.size, stdout);
+    total_written_size += state.size;
+  }
+  return total_written_size;
+}
+
+#define fmt_print_chunked(chunk_size, fmt, ...) \
+  fmt_print_chunked_va((chunk_size), FMT_VA_ARGS(fmt, ##__VA_ARGS__))
 
 
 int main(int argc, char **argv) {
@@ -165,6 +222,126 @@ int main(int argc, char **argv) {
     fmt_print("float {} + double {} = {|.10}\n", x, y, x + y);
   }
 
+  {
+    char *msg = "say \"hi\"\tC:\\path\n\x01\x7f end of a longer string";
+    fmt_print("json: \"{:j}\"\n", msg);
+    fmt_print("c:    \"{:q}\"\n", msg);
+    fmt_print("padded: [{:-12j}] [{:12q}]\n", "a\nb", "a\nb");
+
+    // Escape sequences split across fmt_chunk() calls.
+    fmt_print_chunked(3, "tiny chunks: \"{:j}\"\n", msg);
+    char small[5];
+    int res = fmt_sn(small, sizeof small, "{:j}", "\x01\x02");
+    fmt_print("{} {}\n", res, small);
+  }
+
+  {
+    uint8_t bytes[100];
+    for (size_t i = 0; i < sizeof bytes; i++) bytes[i] = i * 7 + 30;
+    fmt_print("bytes: {}\n", fmt_bytes(bytes, 20));
+    fmt_print("bytes: {:X}\n", fmt_bytes(bytes, 20));
+    fmt_print("bytes: [{:-8}] [{:8}]\n", fmt_bytes(bytes, 2), fmt_bytes(bytes, 2));
+    fmt_print_chunked(3, "tiny chunks: {}\n", fmt_bytes(bytes, 20));
+    fmt_print("{:h}", fmt_bytes(bytes, sizeof bytes));
+    fmt_print_chunked(5, "{:h}", fmt_bytes(bytes, 20));
+    char *s = fmt_malloc("{:x}", fmt_bytes(bytes, 3));
+    fmt_print("allocated hex: {}\n", s);
+    free(s);
+  }
+
+  {
+    int32_t ints[] = {1, -20, 300, INT32_MIN, 5, 6, 7, 8, 9, 10};
+    char *strs[] = {"a", "b\"c"};
+    fmt_print("array: [{}]\n", fmt_array(ints, 10));
+    fmt_print("array: {:04x|:}\n", fmt_array(ints, 3));
+    fmt_print("array: [\"{:j|\", \"}\"]\n", fmt_array(strs, 2));
+    fmt_print("array: [{:-3|}] [{}]\n", fmt_array(ints, 3), fmt_array(ints, 0));
+    fmt_print_chunked(3, "tiny chunks: [{}]\n", fmt_array(ints, 10));
+    fmt_print_chunked(3, "tiny chunks: [{:4}]\n", fmt_array(ints, 10));
+    // Elements longer than a chunk resume where they left off.
+    char *long_strs[] = {"a \"quoted\" string\tlonger than a chunk", "b"};
+    fmt_print_chunked(3, "tiny chunks: [{:-40j|, }]\n", fmt_array(long_strs, 2));
+    uint8_t some_bytes[] = {0xde, 0xad, 0xbe, 0xef, 0x01, 0x02, 0x03, 0x04};
+    FmtBytes byte_strs[] = {fmt_bytes(some_bytes, 8), fmt_bytes(some_bytes, 2)};
+    fmt_print_chunked(3, "tiny chunks: [{:20|, }]\n", fmt_array(byte_strs, 2));
+
+    uint64_t big[1000];
+    for (size_t i = 0; i < 1000; i++) big[i] = i * i * i * 1000003u;
+    char *s = fmt_malloc("{| }", fmt_array(big, 1000));
+    size_t len = strlen(s);
+    fmt_print("big array: {} bytes, ends with {}\n", len, s + len - 24);
+    free(s);
+  }
+
+  {
+    char *names[] = {"Bob", "Zoë", "Ñandú", "日本語", "Wolfeschlegelsteinhausen",
+                     "Ærøskøbing Ærøskøbing", "東京都千代田区丸の内"};
+    for (int i = 0; i < 7; i++) {
+      fmt_print("|{:-24}|{:24}|{:-24j}|\n", names[i], names[i], names[i]);
+    }
+    fmt_print("utf-8 chars: {:c}{:c}{:c}{:c} {:c}\n",
+              233, 0x263a, 0x1f600, -1, (char)'A');
+  }
+
+  {
+    const char *line = "GET /index.html 200 -42 ff0a true (nil) {3,-4} tail";
+    FmtStr method, path, rest;
+    uint16_t status;
+    int64_t delta;
+    uint32_t hex;
+    bool flag;
+    void *ptr = &flag;
+    Point point;
+    int n = fmt_scan(line, strlen(line), "{} {} {} {} {:x} {} {} {} {}",
+                     &method, &path, &status, &delta, &hex, &flag, &ptr,
+                     &point, &rest);
+    fmt_print("scanned {}:\n", n);
+    fmt_print("  {} {} {} {} {} {} {:p} {} [{}]\n", method, path,
+              status, delta, hex, flag, ptr, point, rest);
+
+    uint64_t big;
+    uint8_t small;
+    char *numbers = "99999999999999999999 256 0x1234abcdEF012345";
+    fmt_print("overflow: {} {}\n",
+              fmt_scan(numbers, strlen(numbers), "{}", &big),
+              fmt_scan(numbers + 21, 3, "{}", &small));
+    fmt_scan(numbers + 27, 16, "{:x}", &big);
+    fmt_print("hex: {:x}\n", big);
+    fmt_print("mismatch: {}\n", fmt_scan("a=1 b=x", 7, "a={} b={}", &n, &n));
+
+    // Feed the input a few bytes at a time.
+    char *lines = "id=123456789012 name=alice\n";
+    uint64_t id;
+    FmtStr name;
+    char buf[64];
+    size_t have = 0;
+    size_t fed = 0;
+    size_t total = strlen(lines);
+    FmtScanState state;
+    fmt_scan_init_args(&state, "id={} name={}\n", &id, &name);
+    while (true) {
+      size_t more = total - fed < 5 ? total - fed : 5;
+      memcpy(buf + have, lines + fed, more);
+      have += more;
+      fed += more;
+      FmtScanStatus status = fmt_scan_chunk(&state, buf, have, fed == total);
+      if (status != FmtScanMore) break;
+      memmove(buf, buf + state.size, have - state.size);
+      have -= state.size;
+    }
+    fmt_print("streamed: {} {} {}\n", state.scanned_count, id, name);
+  }
+
+  {
+    fmt_print("compact: {}, sizeof(FmtState): {}, text_buf: {}\n",
+              (bool)FMT_COMPACT, sizeof(FmtState), (size_t)FMT_SHOW_BUF_MAX);
+#if FMT_COMPACT
+    _Static_assert(sizeof(FmtState) <= FMT_CHECK_MAX_STATE_SIZE,
+                   "FmtState is too big for compact mode");
+#endif
+    fmt_print("binary: {:b} {:070b}\n", UINT64_MAX, (uint64_t)1 << 40);
+  }
+
   {
     char *s = fmt_malloc("{} {}", "some memory", 123);
     fmt_print("allocated: {}\n", s);
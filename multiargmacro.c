@@ -1,12 +1,51 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// For the show_* conversion routines.
+#define FMT_IMPL
+#include "fmt.h"
+
+// The argument types, as X(type, name, visit): GET_ARG_TYPE maps type to
+// arg_type_##name, and visit(out, data) renders a value of that type, given
+// a pointer to it. size_t is one of the unsigned types here, so it needs no
+// entry of its own (and _Generic wouldn't allow a second one).
+#define ARG_BUILTIN_TYPES(X) \
+	X(char, char, visit_char) \
+	X(signed char, schar, visit_schar) \
+	X(unsigned char, uchar, visit_uchar) \
+	X(short, short, visit_short) \
+	X(unsigned short, ushort, visit_ushort) \
+	X(int, int, visit_int) \
+	X(unsigned int, uint, visit_uint) \
+	X(long, long, visit_long) \
+	X(unsigned long, ulong, visit_ulong) \
+	X(long long, llong, visit_llong) \
+	X(unsigned long long, ullong, visit_ullong) \
+	X(_Bool, bool, visit_bool) \
+	X(float, float, visit_float) \
+	X(double, double, visit_double) \
+	X(char*, ptr_char, visit_ptr_char) \
+	X(void*, ptr_void, visit_ptr_void)
+
+// To add your own, define ARG_CUSTOM_TYPES the same way before this point,
+// and define each visit function:
+//   void visit_point(arg_buffer* out, const void* data);
+#ifndef ARG_CUSTOM_TYPES
+#define ARG_CUSTOM_TYPES(X)
+#endif
+
+#define ARG_TYPES(X) ARG_BUILTIN_TYPES(X) ARG_CUSTOM_TYPES(X)
+
+#define ARG_TYPE_ENUM(type, name, visit) arg_type_##name,
 
 enum arg_type {
 	arg_type_shrug,
-	arg_type_int,
-	arg_type_double,
-	arg_type_ptr_char,
-    arg_type_ptr_void
+	ARG_TYPES(ARG_TYPE_ENUM)
+	arg_type_count
 };
 
 typedef struct arg_ {
@@ -14,13 +53,30 @@ typedef struct arg_ {
 	void* data;
 } arg;
 
+// Where process_args() renders its output. Arguments are appended to data,
+// which is written to file (if there is one) when it fills up and once at the
+// end of each call. With no file, the caller uses data and size itself.
+typedef struct arg_buffer_ {
+	char* data;
+	size_t capacity;
+	size_t size;
+	FILE* file;
+} arg_buffer;
+
+// For visit functions: appends text to out.
+void arg_buffer_write(arg_buffer* out, const char* text, size_t size);
+
+#define ARG_VISIT_DECL(type, name, visit) \
+	void visit(arg_buffer* out, const void* data);
+
+ARG_TYPES(ARG_VISIT_DECL)
+
+#define ARG_TYPE_CASE(type, name, visit) type: arg_type_##name,
+
 #define GET_ARG_TYPE(value) _Generic(value, \
-	int: arg_type_int, \
-	double: arg_type_double, \
-	char*: arg_type_ptr_char, \
+	ARG_TYPES(ARG_TYPE_CASE) \
 	const char*: arg_type_ptr_char, \
-	void*: arg_type_ptr_void, \
-	/* and so on, and so forth... */ \
+	const void*: arg_type_ptr_void, \
 	default: arg_type_shrug \
 )
 
@@ -30,38 +86,538 @@ typedef struct arg_ {
 #define GET_ARG(value) \
 	(arg){ GET_ARG_TYPE(value), GET_ARG_DATA(value) }
 
-void process_arg(arg arg0);
+// Arguments are passed as a contiguous array with its length, which is known
+// at compile time: no va_list, and no sentinel to check for.
+void process_arg_pack(arg_buffer* out, const arg* args, size_t count);
 
-void process_all_args(int marker_argument, ...);
+// out can be NULL, to use a per-thread buffer that's written to stdout.
+#define process_args_to(out, ...) \
+	process_arg_pack( (out), \
+		(const arg[]){ PROCESS_ARGS_LIST(__VA_ARGS__) }, \
+		PROCESS_ARGS_COUNT(__VA_ARGS__) )
+
+#define process_args(...) process_args_to(NULL, __VA_ARGS__)
+
+void process_arg(arg_buffer* out, arg arg0);
+
+// The old ABI, kept for comparison: a marker, then args by value up to a
+// sentinel.
+void process_all_args(arg_buffer* out, int marker_argument, ...);
 
 #define PROCESS_ARG_LAST() (arg){ arg_type_shrug, NULL }
 
-#define PROCESS_ARG0()         PROCESS_ARG_LAST() // and we're done!!
-#define PROCESS_ARG1(val)      GET_ARG(val), PROCESS_ARG0()
+// PROCESS_ARGn, PROCESS_ARGS_SELECT and PROCESS_ARGS_COUNT are generated, for
+// up to 64 arguments.
+#define PROCESS_ARG0()         // and we're done!!
+#define PROCESS_ARG1(val)      GET_ARG(val)
 #define PROCESS_ARG2(val, ...) GET_ARG(val), PROCESS_ARG1(__VA_ARGS__)
 #define PROCESS_ARG3(val, ...) GET_ARG(val), PROCESS_ARG2(__VA_ARGS__)
 #define PROCESS_ARG4(val, ...) GET_ARG(val), PROCESS_ARG3(__VA_ARGS__)
 #define PROCESS_ARG5(val, ...) GET_ARG(val), PROCESS_ARG4(__VA_ARGS__)
 #define PROCESS_ARG6(val, ...) GET_ARG(val), PROCESS_ARG5(__VA_ARGS__)
 #define PROCESS_ARG7(val, ...) GET_ARG(val), PROCESS_ARG6(__VA_ARGS__)
+#define PROCESS_ARG8(val, ...) GET_ARG(val), PROCESS_ARG7(__VA_ARGS__)
+#define PROCESS_ARG9(val, ...) GET_ARG(val), PROCESS_ARG8(__VA_ARGS__)
+#define PROCESS_ARG10(val, ...) GET_ARG(val), PROCESS_ARG9(__VA_ARGS__)
+#define PROCESS_ARG11(val, ...) GET_ARG(val), PROCESS_ARG10(__VA_ARGS__)
+#define PROCESS_ARG12(val, ...) GET_ARG(val), PROCESS_ARG11(__VA_ARGS__)
+#define PROCESS_ARG13(val, ...) GET_ARG(val), PROCESS_ARG12(__VA_ARGS__)
+#define PROCESS_ARG14(val, ...) GET_ARG(val), PROCESS_ARG13(__VA_ARGS__)
+#define PROCESS_ARG15(val, ...) GET_ARG(val), PROCESS_ARG14(__VA_ARGS__)
+#define PROCESS_ARG16(val, ...) GET_ARG(val), PROCESS_ARG15(__VA_ARGS__)
+#define PROCESS_ARG17(val, ...) GET_ARG(val), PROCESS_ARG16(__VA_ARGS__)
+#define PROCESS_ARG18(val, ...) GET_ARG(val), PROCESS_ARG17(__VA_ARGS__)
+#define PROCESS_ARG19(val, ...) GET_ARG(val), PROCESS_ARG18(__VA_ARGS__)
+#define PROCESS_ARG20(val, ...) GET_ARG(val), PROCESS_ARG19(__VA_ARGS__)
+#define PROCESS_ARG21(val, ...) GET_ARG(val), PROCESS_ARG20(__VA_ARGS__)
+#define PROCESS_ARG22(val, ...) GET_ARG(val), PROCESS_ARG21(__VA_ARGS__)
+#define PROCESS_ARG23(val, ...) GET_ARG(val), PROCESS_ARG22(__VA_ARGS__)
+#define PROCESS_ARG24(val, ...) GET_ARG(val), PROCESS_ARG23(__VA_ARGS__)
+#define PROCESS_ARG25(val, ...) GET_ARG(val), PROCESS_ARG24(__VA_ARGS__)
+#define PROCESS_ARG26(val, ...) GET_ARG(val), PROCESS_ARG25(__VA_ARGS__)
+#define PROCESS_ARG27(val, ...) GET_ARG(val), PROCESS_ARG26(__VA_ARGS__)
+#define PROCESS_ARG28(val, ...) GET_ARG(val), PROCESS_ARG27(__VA_ARGS__)
+#define PROCESS_ARG29(val, ...) GET_ARG(val), PROCESS_ARG28(__VA_ARGS__)
+#define PROCESS_ARG30(val, ...) GET_ARG(val), PROCESS_ARG29(__VA_ARGS__)
+#define PROCESS_ARG31(val, ...) GET_ARG(val), PROCESS_ARG30(__VA_ARGS__)
+#define PROCESS_ARG32(val, ...) GET_ARG(val), PROCESS_ARG31(__VA_ARGS__)
+#define PROCESS_ARG33(val, ...) GET_ARG(val), PROCESS_ARG32(__VA_ARGS__)
+#define PROCESS_ARG34(val, ...) GET_ARG(val), PROCESS_ARG33(__VA_ARGS__)
+#define PROCESS_ARG35(val, ...) GET_ARG(val), PROCESS_ARG34(__VA_ARGS__)
+#define PROCESS_ARG36(val, ...) GET_ARG(val), PROCESS_ARG35(__VA_ARGS__)
+#define PROCESS_ARG37(val, ...) GET_ARG(val), PROCESS_ARG36(__VA_ARGS__)
+#define PROCESS_ARG38(val, ...) GET_ARG(val), PROCESS_ARG37(__VA_ARGS__)
+#define PROCESS_ARG39(val, ...) GET_ARG(val), PROCESS_ARG38(__VA_ARGS__)
+#define PROCESS_ARG40(val, ...) GET_ARG(val), PROCESS_ARG39(__VA_ARGS__)
+#define PROCESS_ARG41(val, ...) GET_ARG(val), PROCESS_ARG40(__VA_ARGS__)
+#define PROCESS_ARG42(val, ...) GET_ARG(val), PROCESS_ARG41(__VA_ARGS__)
+#define PROCESS_ARG43(val, ...) GET_ARG(val), PROCESS_ARG42(__VA_ARGS__)
+#define PROCESS_ARG44(val, ...) GET_ARG(val), PROCESS_ARG43(__VA_ARGS__)
+#define PROCESS_ARG45(val, ...) GET_ARG(val), PROCESS_ARG44(__VA_ARGS__)
+#define PROCESS_ARG46(val, ...) GET_ARG(val), PROCESS_ARG45(__VA_ARGS__)
+#define PROCESS_ARG47(val, ...) GET_ARG(val), PROCESS_ARG46(__VA_ARGS__)
+#define PROCESS_ARG48(val, ...) GET_ARG(val), PROCESS_ARG47(__VA_ARGS__)
+#define PROCESS_ARG49(val, ...) GET_ARG(val), PROCESS_ARG48(__VA_ARGS__)
+#define PROCESS_ARG50(val, ...) GET_ARG(val), PROCESS_ARG49(__VA_ARGS__)
+#define PROCESS_ARG51(val, ...) GET_ARG(val), PROCESS_ARG50(__VA_ARGS__)
+#define PROCESS_ARG52(val, ...) GET_ARG(val), PROCESS_ARG51(__VA_ARGS__)
+#define PROCESS_ARG53(val, ...) GET_ARG(val), PROCESS_ARG52(__VA_ARGS__)
+#define PROCESS_ARG54(val, ...) GET_ARG(val), PROCESS_ARG53(__VA_ARGS__)
+#define PROCESS_ARG55(val, ...) GET_ARG(val), PROCESS_ARG54(__VA_ARGS__)
+#define PROCESS_ARG56(val, ...) GET_ARG(val), PROCESS_ARG55(__VA_ARGS__)
+#define PROCESS_ARG57(val, ...) GET_ARG(val), PROCESS_ARG56(__VA_ARGS__)
+#define PROCESS_ARG58(val, ...) GET_ARG(val), PROCESS_ARG57(__VA_ARGS__)
+#define PROCESS_ARG59(val, ...) GET_ARG(val), PROCESS_ARG58(__VA_ARGS__)
+#define PROCESS_ARG60(val, ...) GET_ARG(val), PROCESS_ARG59(__VA_ARGS__)
+#define PROCESS_ARG61(val, ...) GET_ARG(val), PROCESS_ARG60(__VA_ARGS__)
+#define PROCESS_ARG62(val, ...) GET_ARG(val), PROCESS_ARG61(__VA_ARGS__)
+#define PROCESS_ARG63(val, ...) GET_ARG(val), PROCESS_ARG62(__VA_ARGS__)
+#define PROCESS_ARG64(val, ...) GET_ARG(val), PROCESS_ARG63(__VA_ARGS__)
 
-#define PROCESS_ARGS_SELECT(inv1, inv2, inv3, inv4, inv5, inv6, inv7, INVOKE_THIS_ONE, ...) \
+#define PROCESS_ARGS_SELECT( \
+	inv1, inv2, inv3, inv4, inv5, inv6, inv7, inv8, inv9, inv10, inv11, \
+	inv12, inv13, inv14, inv15, inv16, inv17, inv18, inv19, inv20, inv21, \
+	inv22, inv23, inv24, inv25, inv26, inv27, inv28, inv29, inv30, inv31, \
+	inv32, inv33, inv34, inv35, inv36, inv37, inv38, inv39, inv40, inv41, \
+	inv42, inv43, inv44, inv45, inv46, inv47, inv48, inv49, inv50, inv51, \
+	inv52, inv53, inv54, inv55, inv56, inv57, inv58, inv59, inv60, inv61, \
+	inv62, inv63, inv64, INVOKE_THIS_ONE, ...) \
 	INVOKE_THIS_ONE
 
-#define process_args(...) \
-	process_all_args( 0xAAAA, PROCESS_ARGS_SELECT(__VA_ARGS__, \
-        PROCESS_ARG7, PROCESS_ARG6, PROCESS_ARG5, \
-		PROCESS_ARG4, PROCESS_ARG3, PROCESS_ARG2, \
-		PROCESS_ARG1, PROCESS_ARG0)(__VA_ARGS__))
+#define PROCESS_ARGS_LIST(...) \
+	PROCESS_ARGS_SELECT(__VA_ARGS__, \
+		PROCESS_ARG64, PROCESS_ARG63, PROCESS_ARG62, PROCESS_ARG61, \
+		PROCESS_ARG60, PROCESS_ARG59, PROCESS_ARG58, PROCESS_ARG57, \
+		PROCESS_ARG56, PROCESS_ARG55, PROCESS_ARG54, PROCESS_ARG53, \
+		PROCESS_ARG52, PROCESS_ARG51, PROCESS_ARG50, PROCESS_ARG49, \
+		PROCESS_ARG48, PROCESS_ARG47, PROCESS_ARG46, PROCESS_ARG45, \
+		PROCESS_ARG44, PROCESS_ARG43, PROCESS_ARG42, PROCESS_ARG41, \
+		PROCESS_ARG40, PROCESS_ARG39, PROCESS_ARG38, PROCESS_ARG37, \
+		PROCESS_ARG36, PROCESS_ARG35, PROCESS_ARG34, PROCESS_ARG33, \
+		PROCESS_ARG32, PROCESS_ARG31, PROCESS_ARG30, PROCESS_ARG29, \
+		PROCESS_ARG28, PROCESS_ARG27, PROCESS_ARG26, PROCESS_ARG25, \
+		PROCESS_ARG24, PROCESS_ARG23, PROCESS_ARG22, PROCESS_ARG21, \
+		PROCESS_ARG20, PROCESS_ARG19, PROCESS_ARG18, PROCESS_ARG17, \
+		PROCESS_ARG16, PROCESS_ARG15, PROCESS_ARG14, PROCESS_ARG13, \
+		PROCESS_ARG12, PROCESS_ARG11, PROCESS_ARG10, PROCESS_ARG9, \
+		PROCESS_ARG8, PROCESS_ARG7, PROCESS_ARG6, PROCESS_ARG5, \
+		PROCESS_ARG4, PROCESS_ARG3, PROCESS_ARG2, PROCESS_ARG1, \
+		PROCESS_ARG0)(__VA_ARGS__)
+
+#define PROCESS_ARGS_COUNT(...) \
+	PROCESS_ARGS_SELECT(__VA_ARGS__, \
+		64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, \
+		47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, \
+		30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, \
+		13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+#define process_all_args_va(out, ...) \
+	process_all_args( (out), 0xAAAA, PROCESS_ARGS_LIST(__VA_ARGS__), PROCESS_ARG_LAST() )
+
+/* the old way, for comparison: one printf per argument */
+
+void process_arg_printf(FILE* file, arg arg0) {
+	switch (arg0.type) {
+		case arg_type_int:
+			fprintf(file, "%d", *(int*)arg0.data);
+			break;
+		case arg_type_double:
+			fprintf(file, "%f", *(double*)arg0.data);
+			break;
+		case arg_type_ptr_char:
+			fprintf(file, "%s", *(char**)arg0.data);
+			break;
+		case arg_type_ptr_void:
+			fprintf(file, "%p", *(void**)arg0.data);
+			break;
+		default:
+			fprintf(file, "(unknown type!) %p", arg0.data);
+			break;
+	}
+}
+
+void process_all_args_printf(FILE* file, int marker_argument, ...) {
+	va_list all_args;
+	va_start(all_args, marker_argument);
+	while (1) {
+		arg current_arg = va_arg(all_args, arg);
+		if (current_arg.data == NULL
+		   && current_arg.type == arg_type_shrug) {
+		   break;
+		}
+		process_arg_printf(file, current_arg);
+	}
+	va_end(all_args);
+}
+
+#define process_args_printf(file, ...) \
+	process_all_args_printf( (file), 0xAAAA, PROCESS_ARGS_LIST(__VA_ARGS__), PROCESS_ARG_LAST() )
+
+static double seconds_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+enum {
+	BENCH_RUNS = 21,
+	BENCH_ITERATIONS = 100000
+};
+
+typedef struct bench_result_ {
+	const char* name;
+	double samples[BENCH_RUNS]; // ns per argument, sorted once done
+} bench_result;
+
+static void arg_buffer_flush(arg_buffer* out);
+
+// What process_args_to(out, BENCH_ARGS_16) does, calling each visitor
+// directly instead of packing the arguments.
+static void direct_16(arg_buffer* out, int i) {
+	char* text;
+	int number;
+	double real;
+	void* pointer;
+	text = "id="; visit_ptr_char(out, &text);
+	number = i; visit_int(out, &number);
+	text = " load="; visit_ptr_char(out, &text);
+	real = i * 0.25; visit_double(out, &real);
+	text = " at "; visit_ptr_char(out, &text);
+	pointer = out; visit_ptr_void(out, &pointer);
+	text = " "; visit_ptr_char(out, &text);
+	number = i + 1; visit_int(out, &number);
+	text = " "; visit_ptr_char(out, &text);
+	number = i + 2; visit_int(out, &number);
+	text = " "; visit_ptr_char(out, &text);
+	real = i * 0.5; visit_double(out, &real);
+	text = " "; visit_ptr_char(out, &text);
+	number = i + 3; visit_int(out, &number);
+	text = "\n"; visit_ptr_char(out, &text);
+	pointer = NULL; visit_ptr_void(out, &pointer);
+	arg_buffer_flush(out);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest rank, of sorted samples.
+static double bench_percentile(const bench_result* result, double p) {
+	int rank = (int)(p * BENCH_RUNS);
+	return result->samples[rank < BENCH_RUNS ? rank : BENCH_RUNS - 1];
+}
+
+// Runs call BENCH_ITERATIONS times to warm up, and then BENCH_RUNS more
+// times, timing each.
+#define BENCH_TIME(result, args_per_call, call) \
+	for (int run = -1; run < BENCH_RUNS; run++) { \
+		double start = seconds_now(); \
+		for (int i = 0; i < BENCH_ITERATIONS; i++) { \
+			call; \
+		} \
+		if (run >= 0) { \
+			(result)->samples[run] = (seconds_now() - start) * 1e9 \
+				/ BENCH_ITERATIONS / (args_per_call); \
+		} \
+	}
+
+// Run with "bench" as the first argument to compare against printf and
+// against calling the visitors directly, and with a file name after that
+// to write the results there as JSON too, like dynamic_array_bench does.
+static void bench(const char* json_path) {
+	FILE* null_file = fopen("/dev/null", "w");
+	if (!null_file) {
+		perror("/dev/null");
+		return;
+	}
+	char data[4096];
+	arg_buffer out = { data, sizeof data, 0, null_file };
+	bench_result results[8] = {
+		{ .name = "process_args/printf/1_arg" },
+		{ .name = "process_args/va_list/1_arg" },
+		{ .name = "process_args/pack/1_arg" },
+		{ .name = "process_args/direct/1_arg" },
+		{ .name = "process_args/printf/16_args" },
+		{ .name = "process_args/va_list/16_args" },
+		{ .name = "process_args/pack/16_args" },
+		{ .name = "process_args/direct/16_args" },
+	};
+
+	// 1 argument per call
+	BENCH_TIME(&results[0], 1, process_args_printf(null_file, i));
+	BENCH_TIME(&results[1], 1, process_all_args_va(&out, i));
+	BENCH_TIME(&results[2], 1, process_args_to(&out, i));
+	BENCH_TIME(&results[3], 1, (visit_int(&out, &i), arg_buffer_flush(&out)));
+
+	// 16 arguments per call
+	#define BENCH_ARGS_16 \
+		"id=", i, " load=", i * 0.25, " at ", (void*)&out, " ", i + 1, \
+		" ", i + 2, " ", i * 0.5, " ", i + 3, "\n", (void*)NULL
+
+	BENCH_TIME(&results[4], 16, process_args_printf(null_file, BENCH_ARGS_16));
+	BENCH_TIME(&results[5], 16, process_all_args_va(&out, BENCH_ARGS_16));
+	BENCH_TIME(&results[6], 16, process_args_to(&out, BENCH_ARGS_16));
+	BENCH_TIME(&results[7], 16, direct_16(&out, i));
+	#undef BENCH_ARGS_16
 
-int main () {
+	fclose(null_file);
+	size_t result_count = sizeof results / sizeof results[0];
+	printf("%-30s %8s %8s %8s %8s %8s\n", "ns/arg", "min", "p50", "p90", "p99", "max");
+	for (size_t r = 0; r < result_count; r++) {
+		bench_result* result = &results[r];
+		qsort(result->samples, BENCH_RUNS, sizeof(double), compare_doubles);
+		printf("%-30s %8.1f %8.1f %8.1f %8.1f %8.1f\n", result->name,
+			result->samples[0], bench_percentile(result, 0.5),
+			bench_percentile(result, 0.9), bench_percentile(result, 0.99),
+			result->samples[BENCH_RUNS - 1]);
+	}
+
+	if (!json_path) {
+		return;
+	}
+	FILE* json = fopen(json_path, "w");
+	if (!json) {
+		perror(json_path);
+		return;
+	}
+	fprintf(json, "{\n  \"runs\": %d,\n  \"results\": [", BENCH_RUNS);
+	for (size_t r = 0; r < result_count; r++) {
+		bench_result* result = &results[r];
+		fprintf(json, "%s\n    {\"name\": \"%s\", \"unit\": \"ns/arg\", "
+			"\"samples\": %d, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+			"\"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+			r > 0 ? "," : "", result->name, BENCH_RUNS, result->samples[0],
+			bench_percentile(result, 0.5), bench_percentile(result, 0.9),
+			bench_percentile(result, 0.99), bench_percentile(result, 0.999),
+			result->samples[BENCH_RUNS - 1]);
+	}
+	fprintf(json, "\n  ]\n}\n");
+	fclose(json);
+}
+
+int main (int argc, char** argv) {
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench(argc > 2 ? argv[2] : NULL);
+		return 0;
+	}
 	process_args( NULL, "\n", 1, "\n2\n", 3.0 );
+	process_args( "\n", (short)-4, " ", 5u, " ", -6L, " ", (size_t)7, " ",
+		8.5f, " ", (_Bool)1, " ", (unsigned char)255, " ", (char)'c', "\n" );
 	return 0;
 }
 
 /* implementation of arg processing! */
 
-void process_all_args(int marker_argument, ...) {
+enum {
+	// Enough for any number or pointer.
+	ARG_ITEM_MAX = 64
+};
+
+static void arg_buffer_flush(arg_buffer* out) {
+	if (out->file && out->size > 0) {
+		fwrite(out->data, 1, out->size, out->file);
+		out->size = 0;
+	}
+}
+
+// Makes room for size bytes, if it can.
+static int arg_buffer_reserve(arg_buffer* out, size_t size) {
+	if (out->capacity - out->size < size) {
+		arg_buffer_flush(out);
+	}
+	return out->capacity - out->size >= size;
+}
+
+void arg_buffer_write(arg_buffer* out, const char* text, size_t size) {
+	while (size > 0) {
+		if (out->size == out->capacity) {
+			arg_buffer_flush(out);
+			if (out->size == out->capacity) {
+				// Nowhere to put it.
+				return;
+			}
+		}
+		size_t chunk = out->capacity - out->size;
+		if (chunk > size) chunk = size;
+		memcpy(out->data + out->size, text, chunk);
+		out->size += chunk;
+		text += chunk;
+		size -= chunk;
+	}
+}
+
+// Like printf("%f") for |value| < 1e15, without going through printf for
+// ordinary numbers.
+static int show_double(char* buf, double value) {
+	int len = 0;
+	if (value < 0 || (value == 0 && 1 / value < 0)) {
+		buf[len++] = '-';
+		value = -value;
+	}
+	// Round to six decimal places. The integer and fractional parts are exact,
+	// but scaling the fraction may be off by half an ulp, so values that land
+	// near a tie are left to printf, which rounds the exact binary value.
+	double whole = (double)(uint64_t)value;
+	uint64_t integer = (uint64_t)whole;
+	double scaled = (value - whole) * 1e6;
+	uint64_t fraction = (uint64_t)scaled;
+	double rest = scaled - (double)fraction;
+	if (rest > 0.5 - 1e-9 && rest < 0.5 + 1e-9) {
+		return snprintf(buf, ARG_ITEM_MAX, "%f", len ? -value : value);
+	}
+	if (rest > 0.5) {
+		fraction++;
+	}
+	if (fraction >= 1000000) {
+		integer++;
+		fraction -= 1000000;
+	}
+	len += show_U64_dec(buf + len, integer);
+	buf[len++] = '.';
+	for (int i = 6; i > 0; i--) {
+		buf[len + i - 1] = '0' + fraction % 10;
+		fraction /= 10;
+	}
+	return len + 6;
+}
+
+static _Thread_local char thread_data[4096];
+static _Thread_local arg_buffer thread_out;
+
+static arg_buffer* thread_buffer(void) {
+	thread_out = (arg_buffer){ thread_data, sizeof thread_data, 0, stdout };
+	return &thread_out;
+}
+
+// Numbers go straight into the output buffer if there's room, or into item
+// if there isn't.
+static char* arg_item_start(arg_buffer* out, char* item) {
+	return arg_buffer_reserve(out, ARG_ITEM_MAX) ? out->data + out->size : item;
+}
+
+static void arg_item_end(arg_buffer* out, char* item, char* buf, int len) {
+	if (buf == item) {
+		arg_buffer_write(out, item, len);
+	} else {
+		out->size += len;
+	}
+}
+
+#define ARG_VISIT_NUMBER(visit, type, show) \
+	void visit(arg_buffer* out, const void* data) { \
+		char item[ARG_ITEM_MAX]; \
+		char* buf = arg_item_start(out, item); \
+		arg_item_end(out, item, buf, show(buf, *(const type*)data)); \
+	}
+
+ARG_VISIT_NUMBER(visit_schar, signed char, show_S64_dec)
+ARG_VISIT_NUMBER(visit_uchar, unsigned char, show_U64_dec)
+ARG_VISIT_NUMBER(visit_short, short, show_S64_dec)
+ARG_VISIT_NUMBER(visit_ushort, unsigned short, show_U64_dec)
+ARG_VISIT_NUMBER(visit_int, int, show_S64_dec)
+ARG_VISIT_NUMBER(visit_uint, unsigned int, show_U64_dec)
+ARG_VISIT_NUMBER(visit_long, long, show_S64_dec)
+ARG_VISIT_NUMBER(visit_ulong, unsigned long, show_U64_dec)
+ARG_VISIT_NUMBER(visit_llong, long long, show_S64_dec)
+ARG_VISIT_NUMBER(visit_ullong, unsigned long long, show_U64_dec)
+
+static void write_double(arg_buffer* out, double value) {
+	if (!(value > -1e15 && value < 1e15)) {
+		// Too big for show_double, or inf/nan. %f prints every integer digit,
+		// so this can take over 300 bytes.
+		char big[DBL_MAX_10_EXP + 16];
+		arg_buffer_write(out, big, snprintf(big, sizeof big, "%f", value));
+		return;
+	}
+	char item[ARG_ITEM_MAX];
+	char* buf = arg_item_start(out, item);
+	arg_item_end(out, item, buf, show_double(buf, value));
+}
+
+void visit_float(arg_buffer* out, const void* data) {
+	write_double(out, *(const float*)data);
+}
+
+void visit_double(arg_buffer* out, const void* data) {
+	write_double(out, *(const double*)data);
+}
+
+void visit_char(arg_buffer* out, const void* data) {
+	arg_buffer_write(out, data, 1);
+}
+
+void visit_bool(arg_buffer* out, const void* data) {
+	if (*(const _Bool*)data) {
+		arg_buffer_write(out, "true", 4);
+	} else {
+		arg_buffer_write(out, "false", 5);
+	}
+}
+
+void visit_ptr_char(arg_buffer* out, const void* data) {
+	// points at a character string
+	const char* value = *(char* const*)data;
+	arg_buffer_write(out, value, strlen(value));
+}
+
+void visit_ptr_void(arg_buffer* out, const void* data) {
+	// points at a pointer
+	void* value = *(void* const*)data;
+	char item[ARG_ITEM_MAX];
+	char* buf = arg_item_start(out, item);
+	int len;
+	if (value == NULL) {
+		memcpy(buf, "(nil)", 5);
+		len = 5;
+	} else {
+		memcpy(buf, "0x", 2);
+		len = 2 + show_U64_hex(buf + 2, (uintptr_t)value);
+	}
+	arg_item_end(out, item, buf, len);
+}
+
+static void visit_unknown(arg_buffer* out, const void* data) {
+	char item[ARG_ITEM_MAX];
+	char* buf = arg_item_start(out, item);
+	memcpy(buf, "(unknown type!) 0x", 18);
+	int len = 18 + show_U64_hex(buf + 18, (uintptr_t)data);
+	arg_item_end(out, item, buf, len);
+}
+
+#define ARG_VISIT_ENTRY(type, name, visit) [arg_type_##name] = visit,
+
+// Indexed by type, with no gaps: one indirect call per argument, whatever
+// the number of types.
+static void (* const arg_visitors[arg_type_count])(arg_buffer*, const void*) = {
+	[arg_type_shrug] = visit_unknown,
+	ARG_TYPES(ARG_VISIT_ENTRY)
+};
+
+// Renders args into out, without flushing it.
+static void process_arg_items(arg_buffer* out, const arg* args, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		arg_visitors[args[i].type](out, args[i].data);
+	}
+}
+
+void process_arg_pack(arg_buffer* out, const arg* args, size_t count) {
+	if (out == NULL) {
+		out = thread_buffer();
+	}
+	process_arg_items(out, args, count);
+	arg_buffer_flush(out);
+}
+
+void process_arg(arg_buffer* out, arg arg0) {
+	process_arg_items(out, &arg0, 1);
+}
+
+void process_all_args(arg_buffer* out, int marker_argument, ...) {
+	if (out == NULL) {
+		out = thread_buffer();
+	}
+
 	va_list all_args;
 	va_start(all_args, marker_argument);
 	while (1) {
@@ -71,47 +627,9 @@ void process_all_args(int marker_argument, ...) {
 		   // exit!
 		   break;
 		}
-		process_arg(current_arg);
+		process_arg(out, current_arg);
 	}
 	va_end(all_args);
-}
 
-void process_arg(arg arg0) {
-	switch (arg0.type) {
-		case arg_type_int:
-			{
-				// points at a single integer
-				int value = *(int*)arg0.data;
-				printf("%d", value);
-			}
-			break;
-		case arg_type_double:
-			{
-				// points at a single double
-				double value = *(double*)arg0.data;
-				printf("%f", value);
-			}
-			break;
-		case arg_type_ptr_char:
-			{
-				// points at a character string
-				char* value = *(char**)arg0.data;
-				printf("%s", value);
-			}
-			break;
-		case arg_type_ptr_void:
-			{
-				// points at a character string
-				void* value = *(void**)arg0.data;
-				printf("%p", value);
-			}
-			break;
-		/* and so on, and so forth... */
-		default:
-			{
-				void* value = arg0.data;
-				printf("(unknown type!) %p", value);
-			}
-			break;
-	}
+	arg_buffer_flush(out);
 }